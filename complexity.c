@@ -0,0 +1,116 @@
+/* Least squares fits of complexity classes */
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "complexity.h"
+
+static const char *order_names[O_COUNT] = {
+    [O_1] = "O(1)",
+    [O_LOG_N] = "O(log n)",
+    [O_N] = "O(n)",
+    [O_N_LOG_N] = "O(n log n)",
+    [O_N2] = "O(n^2)",
+};
+
+const char *order_name(order_t order)
+{
+    return order_names[order];
+}
+
+static double model(order_t order, double n)
+{
+    switch (order) {
+    case O_LOG_N:
+        return log2(n);
+    case O_N:
+        return n;
+    case O_N_LOG_N:
+        return n * log2(n);
+    case O_N2:
+        return n * n;
+    default:
+        return 1;
+    }
+}
+
+/* Minimum ratio of b to its standard error for growth to be significant */
+#define GROWTH_T 3
+
+/* Least likelihood, relative to the best fit, of a fit not ruled out */
+#define RIVAL_LIKELIHOOD 0.1
+
+static void fit_one(order_t order, double *n, double *t, int k, fit_t *fit)
+{
+    double sw = 0, sf = 0, st = 0;
+    for (int i = 0; i < k; i++) {
+        double w = 1.0 / (t[i] * t[i]);
+        sw += w;
+        sf += w * model(order, n[i]);
+        st += w * t[i];
+    }
+    double mf = sf / sw, mt = st / sw;
+
+    double sff = 0, sft = 0;
+    for (int i = 0; i < k; i++) {
+        double w = 1.0 / (t[i] * t[i]);
+        double f = model(order, n[i]) - mf;
+        sff += w * f * f;
+        sft += w * f * (t[i] - mt);
+    }
+
+    fit->order = order;
+    fit->b = order == O_1 || sff <= 0 ? 0 : sft / sff;
+    fit->a = mt - fit->b * mf;
+
+    double rss = 0, tss = 0;
+    for (int i = 0; i < k; i++) {
+        double w = 1.0 / (t[i] * t[i]);
+        double r = t[i] - fit->a - fit->b * model(order, n[i]);
+        rss += w * r * r;
+        tss += w * (t[i] - mt) * (t[i] - mt);
+    }
+    int params = order == O_1 ? 1 : 2;
+    fit->err = sqrt(rss / (k - params));
+    fit->r2 = tss > 0 ? 1 - rss / tss : 0;
+
+    /* Standard error of b is err / sqrt(sff) */
+    if (order != O_1 && !(fit->b * sqrt(sff) > GROWTH_T * fit->err)) {
+        fit->aic = INFINITY;
+        return;
+    }
+    /* Corrected for small k, as there are hardly more points than params */
+    fit->aic = k * log(fmax(rss, DBL_MIN) / k) + 2 * params +
+               2.0 * params * (params + 1) / (k - params - 1);
+}
+
+static int cmp_fit(const void *a, const void *b)
+{
+    double ea = ((const fit_t *) a)->aic, eb = ((const fit_t *) b)->aic;
+    return (ea > eb) - (ea < eb);
+}
+
+void fit_complexity(double *n, double *t, int k, fit_t fits[O_COUNT])
+{
+    for (order_t o = 0; o < O_COUNT; o++)
+        fit_one(o, n, t, k, &fits[o]);
+    qsort(fits, O_COUNT, sizeof(fit_t), cmp_fit);
+}
+
+double fit_confidence(fit_t fits[O_COUNT])
+{
+    double sum = 0;
+    for (int i = 0; i < O_COUNT && !isinf(fits[i].aic); i++)
+        sum += exp((fits[0].aic - fits[i].aic) / 2);
+    return 1 / sum;
+}
+
+int fit_rivals(fit_t fits[O_COUNT])
+{
+    int rivals = 0;
+    while (rivals + 1 < O_COUNT && !isinf(fits[rivals + 1].aic) &&
+           exp((fits[0].aic - fits[rivals + 1].aic) / 2) >= RIVAL_LIKELIHOOD)
+        rivals++;
+    return rivals;
+}
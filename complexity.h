@@ -0,0 +1,47 @@
+#ifndef LAB0_COMPLEXITY_H
+#define LAB0_COMPLEXITY_H
+
+/*
+ * Empirical estimate of the complexity class of an operation, from its
+ * running times t[i] on inputs of sizes n[i] > 1.
+ *
+ * Every model t = a + b * f(n) is fitted by least squares weighted by
+ * 1 / t^2, so that each point counts by its relative error whatever its
+ * size.  The constant a takes the fixed cost of a call, which would
+ * otherwise make any operation look slower than its class at small sizes.
+ * O(1) only has a.  A model whose b is not significantly above 0 adds no
+ * growth to O(1), and is left out.  Among the others, the best is the one
+ * of least Akaike information criterion, which weighs the error against the
+ * number of parameters.
+ */
+
+typedef enum { O_1, O_LOG_N, O_N, O_N_LOG_N, O_N2, O_COUNT } order_t;
+
+typedef struct {
+    order_t order;
+    double a, b;
+    double err; /* Root mean square of relative error */
+    double r2;  /* Weighted coefficient of determination */
+    double aic; /* Akaike information criterion, infinite if left out */
+} fit_t;
+
+const char *order_name(order_t order);
+
+/* Fit every model to the k > 3 points, storing fits from best to worst */
+void fit_complexity(double *n, double *t, int k, fit_t fits[O_COUNT]);
+
+/*
+ * Confidence, between 0 and 1, that best fit is not another one.  This is
+ * its Akaike weight, the relative likelihood of the best fit over the sum
+ * of those of every model kept.
+ */
+double fit_confidence(fit_t fits[O_COUNT]);
+
+/*
+ * Number of fits after the best one that cannot be ruled out, being at
+ * least a tenth as likely as the best.  The points then cannot tell them
+ * apart, whatever the confidence.
+ */
+int fit_rivals(fit_t fits[O_COUNT]);
+
+#endif /* LAB0_COMPLEXITY_H */
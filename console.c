@@ -8,13 +8,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "console.h"
+#include "histogram.h"
+#include "perfctr.h"
 #include "report.h"
+#include "timing.h"
 
 /* Some global values */
 bool simulation = false;
@@ -33,6 +37,10 @@ static double last_time;
 /*
  * Implement buffered I/O using variant of RIO package from CS:APP
  * Must create stack of buffers to handle I/O with nested source commands.
+ *
+ * Regular files are mapped into memory and consumed in place, so large
+ * trace files are streamed without a read(2) and copy per RIO_BUFSIZE chunk.
+ * Stdin, pipes and anything else that cannot be mapped fall back to read.
  */
 
 #define RIO_BUFSIZE 8192
@@ -40,8 +48,10 @@ typedef struct RIO_ELE rio_t, *rio_ptr;
 
 struct RIO_ELE {
     int fd;                /* File descriptor */
-    int cnt;               /* Unread bytes in internal buffer */
+    ssize_t cnt;           /* Unread bytes in internal buffer */
     char *bufptr;          /* Next unread byte in internal buffer */
+    char *map;             /* Mapped file contents, NULL when using read */
+    size_t maplen;         /* Length of mapped region */
     char buf[RIO_BUFSIZE]; /* Internal buffer */
     rio_ptr prev;          /* Next element in stack */
 };
@@ -49,6 +59,60 @@ struct RIO_ELE {
 static rio_ptr buf_stack;
 static char linebuf[RIO_BUFSIZE];
 
+/*
+ * Repeat blocks.
+ * Commands between "repeat n" and "end" are tokenized once while the block
+ * is read, and then replayed from that form on every iteration.
+ * Blocks can be nested.
+ */
+typedef struct LOOP_ELE loop_ele, *loop_ptr;
+typedef struct LCMD_ELE lcmd_ele, *lcmd_ptr;
+
+/* One command of a block body */
+struct LCMD_ELE {
+    int argc;
+    char **argv;   /* Tokenized command */
+    loop_ptr loop; /* Nested block instead of a command, or NULL */
+    lcmd_ptr next;
+};
+
+struct LOOP_ELE {
+    int argc;
+    char **argv;        /* Tokenized repeat line */
+    lcmd_ptr body;      /* Commands of the block, in order */
+    lcmd_ptr *last_loc; /* Where to link next recorded command */
+    loop_ptr parent;    /* Enclosing block */
+};
+
+
+/* Nesting of commands run by other commands */
+static int cmd_depth = 0;
+
+/* Integer-valued variables, referenced as $name in command arguments */
+typedef struct VELE var_ele, *var_ptr;
+struct VELE {
+    char *name;
+    int value;
+    var_ptr next;
+};
+
+/*
+ * State of the interpreter belonging to the source of commands: blocks being
+ * recorded, variables, and whether it asked to quit.  The console has its
+ * own, and so has each client session of the server.
+ */
+struct CMD_CONTEXT {
+    loop_ptr loop_rec; /* Innermost block being recorded */
+    var_ptr var_list;
+    bool session; /* Client session, which cannot source files */
+    bool quit;    /* Session asked to quit.  The console sets quit_flag */
+    int state;    /* Kept for the program, through context_hook */
+};
+
+static cmd_context_t console_context;
+static cmd_context_t *context = &console_context;
+static context_hook switch_hook = NULL;
+
 /* Maximum file descriptor */
 static int fd_max = 0;
 
@@ -57,6 +121,11 @@ static int err_limit = 5;
 static int err_cnt = 0;
 static bool echo = 0;
 
+/* Benchmark settings */
+#define BENCH_ITERATIONS 100
+static int bench_warmup = 10;
+static int bench_trim = 0;
+
 static bool quit_flag = false;
 static char *prompt = "cmd> ";
 
@@ -73,7 +142,12 @@ static bool do_option_cmd(int argc, char *argv[]);
 static bool do_source_cmd(int argc, char *argv[]);
 static bool do_log_cmd(int argc, char *argv[]);
 static bool do_time_cmd(int argc, char *argv[]);
+static bool do_bench_cmd(int argc, char *argv[]);
+static bool do_perfctr_cmd(int argc, char *argv[]);
 static bool do_comment_cmd(int argc, char *argv[]);
+static bool do_repeat_cmd(int argc, char *argv[]);
+static bool do_end_cmd(int argc, char *argv[]);
+static bool do_var_cmd(int argc, char *argv[]);
 
 static void init_in();
 
@@ -98,12 +172,30 @@ void init_cmd()
             " file           | Read commands from source file");
     add_cmd("log", do_log_cmd, " file           | Copy output to file");
     add_cmd("time", do_time_cmd, " cmd arg ...    | Time command execution");
+    add_cmd("bench", do_bench_cmd,
+            " [-n N] cmd arg ... | Run command N times and report latency "
+            "percentiles (default: N == 100)");
+    add_cmd("perfctr", do_perfctr_cmd,
+            " cmd arg ...    | Count instructions, cycles, cache and branch "
+            "misses of command");
     add_cmd("#", do_comment_cmd, " ...            | Display comment");
+    add_cmd("repeat", do_repeat_cmd,
+            " n [var]        | Repeat commands up to 'end' n times.  "
+            "Optionally count iterations in var");
+    add_cmd("end", do_end_cmd, "                | End repeat block");
+    add_cmd("var", do_var_cmd,
+            " [name val]     | Display or set variables, used as $name.  "
+            "Value can be 'val op val' with op one of + - * / %");
     add_param("simulation", (int *) &simulation, "Start/Stop simulation mode",
               NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", (int *) &echo, "Do/don't echo commands", NULL);
+    add_param("bench_warmup", &bench_warmup,
+              "Number of untimed iterations before benchmark", NULL);
+    add_param("bench_trim", &bench_trim,
+              "Percent of slowest benchmark iterations left out of mean",
+              NULL);
 
     init_in();
     init_time(&last_time);
@@ -182,6 +274,8 @@ static char **parse_args(char *line, int *argcp)
             *dst++ = c;
         }
     }
+    /* Line need not end with white space */
+    *dst = '\0';
 
     /* Now assemble into array of strings */
     char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
@@ -205,12 +299,75 @@ static void record_error()
     }
 }
 
-/* Execute a command that has already been split into arguments */
-static bool interpret_cmda(int argc, char *argv[])
+/* Free a command line built by parse_args */
+static void free_args(int argc, char *argv[])
 {
-    if (argc == 0)
+    for (int i = 0; i < argc; i++)
+        free_string(argv[i]);
+    free_array(argv, argc, sizeof(char *));
+}
+
+static var_ptr find_var(char *name)
+{
+    var_ptr v = context->var_list;
+    while (v && strcmp(name, v->name) != 0)
+        v = v->next;
+    return v;
+}
+
+static void set_var(char *name, int value)
+{
+    var_ptr v = find_var(name);
+    if (!v) {
+        v = malloc_or_fail(sizeof(var_ele), "set_var");
+        v->name = strsave_or_fail(name, "set_var");
+        v->next = context->var_list;
+        context->var_list = v;
+    }
+    v->value = value;
+}
+
+/* Like get_int, but also accept a reference to a variable */
+static bool get_int_var(char *vname, int *loc)
+{
+    if (vname[0] == '$') {
+        var_ptr v = find_var(vname + 1);
+        if (!v)
+            return false;
+        *loc = v->value;
         return true;
+    }
+    return get_int(vname, loc);
+}
 
+/*
+ * Copy arguments, replacing references to defined variables by their values.
+ * Return NULL when there is nothing to replace.
+ */
+static char **subst_vars(int argc, char *argv[])
+{
+    bool found = false;
+    for (int i = 0; !found && i < argc; i++)
+        found = argv[i][0] == '$' && find_var(argv[i] + 1);
+    if (!found)
+        return NULL;
+
+    char **sargv = calloc_or_fail(argc, sizeof(char *), "subst_vars");
+    for (int i = 0; i < argc; i++) {
+        var_ptr v = argv[i][0] == '$' ? find_var(argv[i] + 1) : NULL;
+        if (v) {
+            char vbuf[16];
+            snprintf(vbuf, sizeof(vbuf), "%d", v->value);
+            sargv[i] = strsave_or_fail(vbuf, "subst_vars");
+        } else
+            sargv[i] = strsave_or_fail(argv[i], "subst_vars");
+    }
+    return sargv;
+}
+
+/* Execute a command after variable substitution */
+static bool exec_cmda(int argc, char *argv[])
+{
     /* Try to find matching command */
     cmd_ptr next_cmd = cmd_list;
     bool ok = true;
@@ -229,10 +386,141 @@ static bool interpret_cmda(int argc, char *argv[])
     return ok;
 }
 
+/* Execute a command that has already been split into arguments */
+static bool interpret_cmda(int argc, char *argv[])
+{
+    if (argc == 0)
+        return true;
+
+    char **sargv = subst_vars(argc, argv);
+    if (sargv)
+        argv = sargv;
+
+    /* Commands run by time, bench and the like count as part of those */
+    /* Comments are not worth a record */
+    bool top = cmd_depth++ == 0 && argv[0][0] != '#';
+    metrics_mark_t mark;
+    if (top)
+        metrics_begin(&mark);
+    bool ok = exec_cmda(argc, argv);
+    if (top)
+        metrics_end(&mark, argc, argv, ok);
+    cmd_depth--;
+
+    if (sargv)
+        free_args(argc, sargv);
+    return ok;
+}
+
+/* Whether the program or the current session is quitting */
+static bool stopping()
+{
+    return quit_flag || context->quit;
+}
+
+static void free_loop(loop_ptr loop)
+{
+    lcmd_ptr c = loop->body;
+    while (c) {
+        lcmd_ptr ele = c;
+        c = c->next;
+        if (ele->loop)
+            free_loop(ele->loop);
+        else
+            free_args(ele->argc, ele->argv);
+        free_block(ele, sizeof(lcmd_ele));
+    }
+    free_args(loop->argc, loop->argv);
+    free_block(loop, sizeof(loop_ele));
+}
+
+/* Replay a recorded block */
+static bool run_loop(loop_ptr loop)
+{
+    int reps;
+    if (!get_int_var(loop->argv[1], &reps) || reps < 0) {
+        report(1, "Invalid repeat count '%s'", loop->argv[1]);
+        record_error();
+        return false;
+    }
+
+    char *var = loop->argc == 3 ? loop->argv[2] : NULL;
+    bool ok = true;
+    for (int i = 0; i < reps && !stopping(); i++) {
+        if (var)
+            set_var(var, i);
+        for (lcmd_ptr c = loop->body; c && !stopping(); c = c->next) {
+            bool cok = c->loop ? run_loop(c->loop)
+                               : interpret_cmda(c->argc, c->argv);
+            ok = ok && cok;
+        }
+    }
+    return ok;
+}
+
+/*
+ * Handle command line while reading a repeat block, or one starting it.
+ * Takes ownership of argv.  The outermost block is run once it is closed.
+ */
+static bool record_cmd(int argc, char *argv[])
+{
+    if (argc > 0 && strcmp(argv[0], "repeat") == 0) {
+        if (argc != 2 && argc != 3) {
+            report(1, "%s needs 1-2 arguments", argv[0]);
+            free_args(argc, argv);
+            record_error();
+            return false;
+        }
+        loop_ptr lnew = malloc_or_fail(sizeof(loop_ele), "record_cmd");
+        lnew->argc = argc;
+        lnew->argv = argv;
+        lnew->body = NULL;
+        lnew->last_loc = &lnew->body;
+        lnew->parent = context->loop_rec;
+        if (context->loop_rec) {
+            lcmd_ptr c = malloc_or_fail(sizeof(lcmd_ele), "record_cmd");
+            c->argc = 0;
+            c->argv = NULL;
+            c->loop = lnew;
+            c->next = NULL;
+            *context->loop_rec->last_loc = c;
+            context->loop_rec->last_loc = &c->next;
+        }
+        context->loop_rec = lnew;
+        return true;
+    }
+
+    if (argc > 0 && strcmp(argv[0], "end") == 0) {
+        free_args(argc, argv);
+        loop_ptr done = context->loop_rec;
+        context->loop_rec = done->parent;
+        if (context->loop_rec)
+            return true;
+        bool ok = run_loop(done);
+        free_loop(done);
+        return ok;
+    }
+
+    /* Blank lines and comments were already echoed */
+    if (argc == 0 || strcmp(argv[0], "#") == 0) {
+        free_args(argc, argv);
+        return true;
+    }
+
+    lcmd_ptr c = malloc_or_fail(sizeof(lcmd_ele), "record_cmd");
+    c->argc = argc;
+    c->argv = argv;
+    c->loop = NULL;
+    c->next = NULL;
+    *context->loop_rec->last_loc = c;
+    context->loop_rec->last_loc = &c->next;
+    return true;
+}
+
 /* Execute a command from a command line */
-static bool interpret_cmd(char *cmdline)
+bool interpret_cmd(char *cmdline)
 {
-    if (quit_flag)
+    if (stopping())
         return false;
 
 #if RPT >= 6
@@ -240,10 +528,11 @@ static bool interpret_cmd(char *cmdline)
 #endif
     int argc;
     char **argv = parse_args(cmdline, &argc);
+    if (context->loop_rec || (argc > 0 && strcmp(argv[0], "repeat") == 0))
+        return record_cmd(argc, argv);
+
     bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
+    free_args(argc, argv);
 
     return ok;
 }
@@ -263,9 +552,84 @@ void set_echo(bool on)
     echo = on ? 1 : 0;
 }
 
+/* Set number of errors until command execution stops */
+void set_err_limit(int limit)
+{
+    err_limit = limit;
+}
+
+/*
+ * Free blocks and variables of ctx.  Return false if a block was still being
+ * recorded
+ */
+static bool clear_context(cmd_context_t *ctx)
+{
+    bool ok = !ctx->loop_rec;
+    if (ctx->loop_rec) {
+        while (ctx->loop_rec->parent)
+            ctx->loop_rec = ctx->loop_rec->parent;
+        free_loop(ctx->loop_rec);
+        ctx->loop_rec = NULL;
+    }
+
+    var_ptr v = ctx->var_list;
+    while (v) {
+        var_ptr ele = v;
+        v = v->next;
+        free_string(ele->name);
+        free_block(ele, sizeof(var_ele));
+    }
+    ctx->var_list = NULL;
+    return ok;
+}
+
+cmd_context_t *new_context()
+{
+    cmd_context_t *ctx = calloc_or_fail(1, sizeof(cmd_context_t),
+                                        "new_context");
+    ctx->session = true;
+    return ctx;
+}
+
+void free_context(cmd_context_t *ctx)
+{
+    clear_context(ctx);
+    free_block(ctx, sizeof(cmd_context_t));
+}
+
+void set_context(cmd_context_t *ctx)
+{
+    if (!ctx)
+        ctx = &console_context;
+    if (ctx == context)
+        return;
+
+    if (switch_hook)
+        switch_hook(&context->state, false);
+    context = ctx;
+    if (switch_hook)
+        switch_hook(&context->state, true);
+}
+
+void set_context_hook(context_hook hook)
+{
+    switch_hook = hook;
+}
+
+bool context_quit(cmd_context_t *ctx)
+{
+    return ctx->quit;
+}
+
 /* Built-in commands */
 static bool do_quit_cmd(int argc, char *argv[])
 {
+    /* Only ends the session, not the program */
+    if (context->session) {
+        context->quit = true;
+        return true;
+    }
+
     cmd_ptr c = cmd_list;
     bool ok = true;
     while (c) {
@@ -284,6 +648,11 @@ static bool do_quit_cmd(int argc, char *argv[])
     while (buf_stack)
         pop_file();
 
+    if (!clear_context(&console_context)) {
+        report(1, "ERROR: Unterminated repeat block");
+        ok = false;
+    }
+
     for (int i = 0; i < quit_helper_cnt; i++) {
         ok = ok && quit_helpers[i](argc, argv);
     }
@@ -385,6 +754,12 @@ static bool do_option_cmd(int argc, char *argv[])
 
 static bool do_source_cmd(int argc, char *argv[])
 {
+    /* Files are those of the server, and would be read instead of clients */
+    if (context->session) {
+        report(1, "%s is not available to client sessions", argv[0]);
+        return false;
+    }
+
     if (argc < 2) {
         report(1, "No source file given");
         return false;
@@ -432,6 +807,197 @@ static bool do_time_cmd(int argc, char *argv[])
     return ok;
 }
 
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Mean of n samples after dropping the slowest trim_pct percent */
+static double trimmed_mean(uint64_t *samples, size_t n, int trim_pct)
+{
+    size_t keep = n - n * trim_pct / 100;
+    if (!keep)
+        return 0.0;
+
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+    double sum = 0;
+    for (size_t i = 0; i < keep; i++)
+        sum += samples[i];
+    return sum / keep;
+}
+
+static bool do_bench_cmd(int argc, char *argv[])
+{
+    int iterations = BENCH_ITERATIONS;
+    if (argc > 1 && !strcmp(argv[1], "-n")) {
+        if (argc < 3 || !get_int(argv[2], &iterations) || iterations <= 0) {
+            report(1, "Invalid number of iterations '%s'",
+                   argc < 3 ? "" : argv[2]);
+            return false;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 2) {
+        report(1, "%s needs a command to run", argv[0]);
+        return false;
+    }
+    if (bench_trim < 0 || bench_trim >= 100) {
+        report(1, "Invalid bench_trim %d", bench_trim);
+        return false;
+    }
+
+    histogram_t *hist = malloc_or_fail(sizeof(histogram_t), "do_bench_cmd");
+    hist_init(hist);
+    /* Raw samples, for the trimmed mean */
+    uint64_t *samples =
+        malloc_or_fail(iterations * sizeof(uint64_t), "do_bench_cmd");
+
+    /* Keep reports of the benchmarked command to errors */
+    int saved_verblevel = verblevel;
+    if (verblevel > 1)
+        verblevel = 1;
+
+    bool ok = true;
+    uint64_t elapsed = 0;
+    for (int i = 0; ok && !stopping() && i < bench_warmup; i++)
+        ok = interpret_cmda(argc - 1, argv + 1);
+    for (int i = 0; ok && !stopping() && i < iterations; i++) {
+        uint64_t start = now_ns();
+        ok = interpret_cmda(argc - 1, argv + 1);
+        uint64_t delta = now_ns() - start;
+        hist_record(hist, delta);
+        samples[hist->total - 1] = delta;
+        elapsed += delta;
+    }
+    verblevel = saved_verblevel;
+
+    if (!ok)
+        report(1, "Benchmark stopped after %lu iterations", hist->total);
+    else {
+        report(1, "%lu iterations of %s, %d warm-up, %d%% trimmed",
+               hist->total, argv[1], bench_warmup, bench_trim);
+        report(1, "Throughput = %.0f ops/sec",
+               elapsed ? hist->total * 1.0E9 / elapsed : 0.0);
+        report(1,
+               "Mean = %.1f ns, p50 = %lu ns, p99 = %lu ns, p99.9 = %lu ns, "
+               "max = %lu ns",
+               trimmed_mean(samples, hist->total, bench_trim),
+               hist_percentile(hist, 50.0), hist_percentile(hist, 99.0),
+               hist_percentile(hist, 99.9), hist->max);
+    }
+
+    free_block(samples, iterations * sizeof(uint64_t));
+    free_block(hist, sizeof(histogram_t));
+    return ok;
+}
+
+static bool do_perfctr_cmd(int argc, char *argv[])
+{
+    if (argc < 2) {
+        report(1, "%s needs a command to run", argv[0]);
+        return false;
+    }
+
+    if (!perfctr_open())
+        report(1, "No performance counter available.  Counting ticks");
+
+    uint64_t before[PCTR_COUNT], after[PCTR_COUNT];
+    perfctr_read(before);
+    bool ok = interpret_cmda(argc - 1, argv + 1);
+    perfctr_read(after);
+
+    uint64_t delta[PCTR_COUNT];
+    for (int i = 0; i < PCTR_COUNT; i++) {
+        delta[i] = after[i] - before[i];
+        /* Cycles are always there, if only as ticks */
+        if (perfctr_available(i) || i == PCTR_CYCLES)
+            report(1, "%-18s %14lu %s", perfctr_name(i), delta[i],
+                   perfctr_unit(i));
+    }
+    if (delta[PCTR_INSTRUCTIONS] && delta[PCTR_CYCLES] &&
+        strcmp(perfctr_unit(PCTR_CYCLES), "cycles") == 0)
+        report(1, "IPC = %.2f",
+               (double) delta[PCTR_INSTRUCTIONS] / delta[PCTR_CYCLES]);
+    if (delta[PCTR_CACHE_REFS])
+        report(1, "Cache miss rate = %.1f%%",
+               100.0 * delta[PCTR_CACHE_MISSES] / delta[PCTR_CACHE_REFS]);
+
+    perfctr_close();
+    return ok;
+}
+
+/* Only reached when repeat does not begin a command line, e.g. under time */
+static bool do_repeat_cmd(int argc, char *argv[])
+{
+    report(1, "%s must begin a command line", argv[0]);
+    return false;
+}
+
+static bool do_end_cmd(int argc, char *argv[])
+{
+    report(1, "%s without matching repeat", argv[0]);
+    return false;
+}
+
+static bool do_var_cmd(int argc, char *argv[])
+{
+    if (argc == 1) {
+        report(1, "Variables:");
+        for (var_ptr v = context->var_list; v; v = v->next)
+            report(1, "\t%s\t%d", v->name, v->value);
+        return true;
+    }
+
+    if (argc != 3 && argc != 5) {
+        report(1, "%s needs 0, 2 or 4 arguments", argv[0]);
+        return false;
+    }
+
+    int value, operand;
+    if (!get_int(argv[2], &value)) {
+        report(1, "Cannot parse '%s' as integer", argv[2]);
+        return false;
+    }
+
+    if (argc == 5) {
+        if (!get_int(argv[4], &operand)) {
+            report(1, "Cannot parse '%s' as integer", argv[4]);
+            return false;
+        }
+        if (strlen(argv[3]) != 1) {
+            report(1, "Unknown operator '%s'", argv[3]);
+            return false;
+        }
+        switch (argv[3][0]) {
+        case '+':
+            value += operand;
+            break;
+        case '-':
+            value -= operand;
+            break;
+        case '*':
+            value *= operand;
+            break;
+        case '/':
+        case '%':
+            if (operand == 0) {
+                report(1, "Division by zero");
+                return false;
+            }
+            value = argv[3][0] == '/' ? value / operand : value % operand;
+            break;
+        default:
+            report(1, "Unknown operator '%s'", argv[3]);
+            return false;
+        }
+    }
+
+    set_var(argv[1], value);
+    return true;
+}
+
 /* Create new buffer for named file.
  * Name == NULL for stdin.
  * Return true if successful.
@@ -449,9 +1015,25 @@ static bool push_file(char *fname)
     rnew->fd = fd;
     rnew->cnt = 0;
     rnew->bufptr = rnew->buf;
+    rnew->map = NULL;
+    rnew->maplen = 0;
     rnew->prev = buf_stack;
     buf_stack = rnew;
 
+    /* Map regular files.  On any failure, just keep reading with read(2) */
+    struct stat st;
+    if (fname && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            rnew->map = map;
+            rnew->maplen = st.st_size;
+            rnew->bufptr = map;
+            rnew->cnt = st.st_size;
+        }
+    }
+
     return true;
 }
 
@@ -461,6 +1043,8 @@ static void pop_file()
     if (buf_stack) {
         rio_ptr rsave = buf_stack;
         buf_stack = rsave->prev;
+        if (rsave->map)
+            munmap(rsave->map, rsave->maplen);
         close(rsave->fd);
         free_block(rsave, sizeof(rio_t));
     }
@@ -472,6 +1056,22 @@ static void init_in()
     buf_stack = NULL;
 }
 
+/*
+ * Refill input buffer of the top element.
+ * A mapped file has been handed over in one piece, so once it is drained
+ * there is nothing left to read.
+ */
+static ssize_t rio_fill(rio_ptr rp)
+{
+    if (rp->map)
+        rp->cnt = 0;
+    else {
+        rp->cnt = read(rp->fd, rp->buf, RIO_BUFSIZE);
+        rp->bufptr = rp->buf;
+    }
+    return rp->cnt;
+}
+
 /* Read command from input file.
  * When hit EOF, close that file and return NULL
  */
@@ -487,9 +1087,7 @@ static char *readline()
     for (cnt = 0; cnt < RIO_BUFSIZE - 2; cnt++) {
         if (buf_stack->cnt <= 0) {
             /* Need to read from input file */
-            buf_stack->cnt = read(buf_stack->fd, buf_stack->buf, RIO_BUFSIZE);
-            buf_stack->bufptr = buf_stack->buf;
-            if (buf_stack->cnt <= 0) {
+            if (rio_fill(buf_stack) <= 0) {
                 /* Encountered EOF */
                 pop_file();
                 if (cnt > 0) {
@@ -532,7 +1130,7 @@ static char *readline()
 /* Determine if there is a complete command line in input buffer */
 static bool read_ready()
 {
-    for (int i = 0; buf_stack && i < buf_stack->cnt; i++) {
+    for (ssize_t i = 0; buf_stack && i < buf_stack->cnt; i++) {
         if (buf_stack->bufptr[i] == '\n')
             return true;
     }
@@ -582,6 +1180,7 @@ int cmd_select(int nfds,
         infd = buf_stack->fd;
         FD_SET(infd, readfds);
         if (infd == STDIN_FILENO && prompt_flag) {
+            report_flush();
             printf("%s", prompt);
             fflush(stdout);
             prompt_flag = true;
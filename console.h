@@ -57,6 +57,36 @@ void add_quit_helper(cmd_function qf);
 /* Turn echoing on/off */
 void set_echo(bool on);
 
+/* Set number of errors until command execution stops */
+void set_err_limit(int limit);
+
+/* Execute a single command line.  Return true if successful */
+bool interpret_cmd(char *cmdline);
+
+/*
+ * Interpreter state of a client session: its repeat blocks, variables and
+ * quit, which ends the session instead of the program.  Sessions cannot
+ * source files.  An int of state is kept for the program, 0 in a new
+ * context.
+ */
+typedef struct CMD_CONTEXT cmd_context_t;
+
+cmd_context_t *new_context();
+void free_context(cmd_context_t *ctx);
+
+/* Run the following commands in ctx, or in the console's own if NULL */
+void set_context(cmd_context_t *ctx);
+
+/*
+ * Have set_context call hook with the state of the context it leaves, with
+ * entering false, then with that of the one it enters, with entering true
+ */
+typedef void (*context_hook)(int *state, bool entering);
+void set_context_hook(context_hook hook);
+
+/* Return true once a command of ctx asked to quit */
+bool context_quit(cmd_context_t *ctx);
+
 /* Complete command interpretation */
 
 /* Return true if no errors occurred */
@@ -1,5 +1,6 @@
 #include "constant.h"
 #include <assert.h>
+#include <malloc.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -7,9 +8,13 @@
 #include <string.h>
 #include <unistd.h>
 #include "cpucycles.h"
+#include "perfctr.h"
 #include "queue.h"
 #include "random.h"
 
+/* Elements of queues are allocated by the harness, so free them likewise */
+#include "harness.h"
+
 #define NR_MEASURE 150
 /* Allow random number range from 0 to 65535 */
 const size_t chunk_size = 16;
@@ -19,14 +24,45 @@ const int drop_size = 20;
 /* Maintain a queue independent from the qtest since
  * we do not want the test to affect the original functionality
  */
-static queue_t *q = NULL;
-static char random_string[NR_MEASURE][8];
-static int random_string_iter = 0;
-enum { test_insert_tail, test_size };
+static __thread queue_t *q = NULL;
+static __thread char random_string[NR_MEASURE][8];
+static __thread int random_string_iter = 0;
+/* Performance counter measured instead of ticks, -1 for none */
+static __thread int counter = -1;
+
+/*
+ * Queues are built once and measured many times, as building them takes far
+ * longer than the operations measured.  Each measurement draws one of
+ * POOL_QUEUES slots, of pool_sizes[slot] elements for the second class, and
+ * one of as many empty queues for the first.  Both classes then go through
+ * the same number of distinct queues, equally likely to be cached.
+ */
+#define POOL_QUEUES 16
+static __thread int pool_sizes[POOL_QUEUES];
+static __thread struct {
+    queue_t *q;
+    int size;
+} pool[2 * POOL_QUEUES];
 
 /* Implement the necessary queue interface to simulation */
 void init_dut(void)
 {
+    uint16_t r[POOL_QUEUES];
+    randombytes((uint8_t *) r, sizeof(r));
+    for (int i = 0; i < POOL_QUEUES; i++)
+        pool_sizes[i] = r[i] % 10000;
+    q = NULL;
+}
+
+void release_dut(void)
+{
+    /* Newest first, as the harness finds recent blocks first */
+    for (int i = 2 * POOL_QUEUES - 1; i >= 0; i--) {
+        q = pool[i].q;
+        if (q)
+            dut_free();
+        pool[i].q = NULL;
+    }
     q = NULL;
 }
 
@@ -45,6 +81,11 @@ void prepare_inputs(uint8_t *input_data, uint8_t *classes)
             *(uint16_t *) (input_data + i * chunk_size) = 0x00;
     }
 
+    prepare_strings();
+}
+
+void prepare_strings(void)
+{
     for (size_t i = 0; i < NR_MEASURE; ++i) {
         /* Generate random string */
         randombytes((uint8_t *) random_string[i], 7);
@@ -52,34 +93,134 @@ void prepare_inputs(uint8_t *input_data, uint8_t *classes)
     }
 }
 
+void set_counter(int ctr)
+{
+    counter = ctr;
+}
+
+static inline int64_t read_counter_begin(void)
+{
+    return counter < 0 ? cpucycles_begin()
+                       : (int64_t) perfctr_read_one(counter);
+}
+
+static inline int64_t read_counter_end(void)
+{
+    return counter < 0 ? cpucycles_end() : (int64_t) perfctr_read_one(counter);
+}
+
+int64_t measure_overhead(void)
+{
+    return counter < 0 ? (int64_t) ticks_overhead() : 0;
+}
+
+/*
+ * New queue of n elements.  Freed blocks are first returned, so that it is
+ * laid out in fresh memory as the first one was, and not scattered over
+ * the blocks of queues freed before.  Traversals of a queue much larger
+ * than the caches take several times longer otherwise.
+ */
+static void build_queue(int n)
+{
+    malloc_trim(0);
+    dut_new();
+    dut_insert_head(get_random_string(), n);
+}
+
+/*
+ * Queue of n elements in slot of the pool, rebuilt if it holds another
+ * number.  Measurements must leave it with n elements
+ */
+static queue_t *pool_take(int slot, int n)
+{
+    if (pool[slot].q && pool[slot].size == n)
+        return pool[slot].q;
+
+    q = pool[slot].q;
+    if (q)
+        dut_free();
+    build_queue(n);
+    pool[slot].q = q;
+    pool[slot].size = n;
+    return q;
+}
+
+/*
+ * Define function timing op on queues of sizes[i] elements, in pool slot
+ * slots[i], for i in [begin, end).  setup gets the queue of n elements, run
+ * is the part being timed and teardown releases or restores what is left.
+ * The whole loop is generated for every operation, so that no call through
+ * a pointer gets mixed with the timing.
+ */
+#define DUT_MEASURE(op, setup, run, teardown)                             \
+    static void measure_##op(int64_t *before_ticks, int64_t *after_ticks, \
+                             int *sizes, int *slots, size_t begin,        \
+                             size_t end)                                  \
+    {                                                                     \
+        for (size_t i = begin; i < end; i++) {                            \
+            int n = sizes[i], slot = slots[i];                            \
+            (void) n;                                                     \
+            (void) slot;                                                  \
+            setup;                                                        \
+            before_ticks[i] = read_counter_begin();                       \
+            run;                                                          \
+            after_ticks[i] = read_counter_end();                          \
+            teardown;                                                     \
+        }                                                                 \
+    }
+
+/* Queues of the pool, restored after the operation */
+#define POOL_SETUP(n)              \
+    q = pool_take(slot, n);        \
+    int size = q_size(q);          \
+    char *s = get_random_string(); \
+    (void) size;                   \
+    (void) s
+
+DUT_MEASURE(insert_head, POOL_SETUP(n), dut_insert_head(s, 1),
+            if (q_size(q) > size) dut_remove_head())
+/* Removing the head restores the size, if not the same elements */
+DUT_MEASURE(insert_tail, POOL_SETUP(n), dut_insert_tail(s, 1),
+            if (q_size(q) > size) dut_remove_head())
+/* One more element, so that there is always one to remove */
+DUT_MEASURE(remove_head, POOL_SETUP(n + 1), dut_remove_head(),
+            if (q_size(q) < size) dut_insert_head(s, 1))
+DUT_MEASURE(size, POOL_SETUP(n), dut_size(1), )
+DUT_MEASURE(new, , dut_new(), dut_free())
+DUT_MEASURE(free, build_queue(n), dut_free(), )
+/* Reversing twice restores the queue */
+DUT_MEASURE(reverse, POOL_SETUP(n), dut_reverse(), dut_reverse())
+/* Distinct strings, or there would be little to sort */
+DUT_MEASURE(sort, dut_new(); for (int j = 0; j < n; j++)
+                dut_insert_head(get_random_string(), 1),
+            dut_sort(), dut_free())
+
+const dut_op_t dut_ops[] = {
+    [test_insert_head] = {"insert_head", measure_insert_head},
+    [test_insert_tail] = {"insert_tail", measure_insert_tail},
+    [test_remove_head] = {"remove_head", measure_remove_head},
+    [test_size] = {"size", measure_size},
+    [test_new] = {"new", measure_new},
+    [test_delete] = {"free", measure_free},
+    [test_reverse] = {"reverse", measure_reverse},
+    [test_sort] = {"sort", measure_sort},
+};
+
 void measure(int64_t *before_ticks,
              int64_t *after_ticks,
              uint8_t *input_data,
              int mode)
 {
-    assert(mode == test_insert_tail || mode == test_size);
-    if (mode == test_insert_tail) {
-        for (size_t i = drop_size; i < number_measurements - drop_size; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * chunk_size) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_insert_tail(s, 1);
-            after_ticks[i] = cpucycles();
-            dut_free();
-        }
-    } else {
-        for (size_t i = drop_size; i < number_measurements - drop_size; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * chunk_size) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_size(1);
-            after_ticks[i] = cpucycles();
-            dut_free();
-        }
+    assert(mode >= 0 && mode < test_count);
+    int sizes[NR_MEASURE], slots[NR_MEASURE];
+    for (size_t i = drop_size; i < number_measurements - drop_size; i++) {
+        /* Size is zeroed for the first class, not the slot drawn */
+        uint16_t v = *(uint16_t *) (input_data + i * chunk_size);
+        uint16_t r = *(uint16_t *) (input_data + i * chunk_size + 2);
+        int slot = r % POOL_QUEUES;
+        sizes[i] = v ? pool_sizes[slot] : 0;
+        slots[i] = v ? slot : POOL_QUEUES + slot;
     }
+    dut_ops[mode].measure(before_ticks, after_ticks, sizes, slots, drop_size,
+                          number_measurements - drop_size);
 }
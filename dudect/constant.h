@@ -1,6 +1,8 @@
 #ifndef DUDECT_CONSTANT_H
 #define DUDECT_CONSTANT_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #define dut_new()    \
     {                \
@@ -27,13 +29,67 @@
             q_insert_tail(q, s); \
     } while (0);
 
+#define dut_remove_head()          \
+    do {                           \
+        q_remove_head(q, NULL, 0); \
+    } while (0);
+
+#define dut_reverse() \
+    do {              \
+        q_reverse(q); \
+    } while (0);
+
+#define dut_sort() \
+    do {           \
+        q_sort(q); \
+    } while (0);
+
 #define dut_free() \
     {              \
         q_free(q); \
     }
 
+/* Operations that can be measured */
+enum {
+    test_insert_head,
+    test_insert_tail,
+    test_remove_head,
+    test_size,
+    test_new,
+    test_delete,
+    test_reverse,
+    test_sort,
+    test_count
+};
+
+/*
+ * Descriptor of a measurable operation.  measure times the operation on
+ * queues of sizes[i] elements, kept in slot slots[i] of a pool of
+ * 2 * POOL_QUEUES queues, storing the ticks right before and after it in
+ * before_ticks[i] and after_ticks[i], for i in [begin, end).
+ */
+typedef struct {
+    char *name;
+    void (*measure)(int64_t *before_ticks,
+                    int64_t *after_ticks,
+                    int *sizes,
+                    int *slots,
+                    size_t begin,
+                    size_t end);
+} dut_op_t;
+
+extern const dut_op_t dut_ops[];
+
 void init_dut();
+/* Free queues kept for measurements of calling thread */
+void release_dut(void);
 void prepare_inputs(uint8_t *input_data, uint8_t *classes);
+/* Fill the strings inserted by the operations */
+void prepare_strings(void);
+/* Measure performance counter ctr of perfctr.h instead of ticks, or -1 */
+void set_counter(int ctr);
+/* Count of an empty measured region, to subtract from measurements */
+int64_t measure_overhead(void);
 void measure(int64_t *before_ticks,
              int64_t *after_ticks,
              uint8_t *input_data,
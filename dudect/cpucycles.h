@@ -1,12 +1,20 @@
 #include <stdint.h>
-// http://www.intel.com/content/www/us/en/embedded/training/ia-32-ia-64-benchmark-code-execution-paper.html
+
+#include "timing.h"
+
+/* Time stamp counter, or nanoseconds where there is none */
 static inline int64_t cpucycles(void)
 {
-#if defined(__i386__) || defined(__x86_64__)
-    unsigned int hi, lo;
-    __asm__ volatile("rdtsc\n\t" : "=a"(lo), "=d"(hi));
-    return ((int64_t) lo) | (((int64_t) hi) << 32);
-#else
-#error Unsupported Architecture
-#endif
+    return read_ticks();
+}
+
+/* Same, serialized to start and end a measured region */
+static inline int64_t cpucycles_begin(void)
+{
+    return read_ticks_begin();
+}
+
+static inline int64_t cpucycles_end(void)
+{
+    return read_ticks_end();
 }
@@ -27,26 +27,89 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include "fixture.h"
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "../console.h"
+#include "../perfctr.h"
 #include "../random.h"
 #include "constant.h"
 #include "ttest.h"
 
+/* Our program needs to use regular malloc/free */
+#define INTERNAL 1
+#include "../harness.h"
+
 #define enough_measurements 10000
 #define test_tries 10
 
+/*
+ * Fewest measurements of each class for a test to be considered.  A try
+ * holds about enough_measurements in all, so half that per class, and the
+ * tightest cropping threshold keeps under a tenth of them.
+ */
+#define enough_class_measurements 100
+
+/*
+ * Besides the uncropped measurements, run one t-test for each of
+ * number_percentiles cropping thresholds, and one second order test.
+ */
+#define number_percentiles 100
+#define number_tests (1 + number_percentiles + 1)
+
+/* Batches measured to set the thresholds before testing */
+#define calibration_batches 10
+
 extern const int drop_size;
 extern const size_t chunk_size;
 extern const size_t number_measurements;
 static t_ctx *t;
 
+/* Cropping thresholds, and mean of each class for the second order test */
+static int64_t percentiles[number_percentiles];
+static double centers[2];
+
+/* Number of measurement threads.  0 means one per available CPU */
+int dudect_threads = 0;
+
+/* Stop each try as soon as its verdict is clear */
+int dudect_sequential = 0;
+
+/* 0 for ticks, or 1 + counter of perfctr.h */
+int dudect_counter = 0;
+
+/* Measurements taken by the last test */
+size_t dudect_measurements = 0;
+
+/* Where samples are written, if anywhere */
+static FILE *samples_file = NULL;
+
+/* Statistics are checked that many times per try in sequential mode */
+#define sequential_rounds 8
+/* Deviation allowed for, in standard deviations, when extrapolating max t */
+#define sequential_margin 3
+
+/* Measurement batches run by one thread, with statistics of its own */
+typedef struct {
+    pthread_t tid;
+    bool running;
+    int mode;
+    int batches;
+    bool calibrate; /* Set thresholds instead of testing */
+    t_ctx t[number_tests];
+    sample_t *samples; /* Room for all measurements, when keeping them */
+    size_t nsamples;
+} worker_t;
+
 /* threshold values for Welch's t-test */
 #define t_threshold_bananas                                                  \
     500                         /* Test failed with overwhelming probability \
@@ -58,16 +121,89 @@ static void __attribute__((noreturn)) die(void)
     exit(111);
 }
 
+/*
+ * Execution times, less the overhead of measuring.  A measurement no larger
+ * than the overhead still counts as one tick, as zero marks dropped ones
+ */
 static void differentiate(int64_t *exec_times,
                           int64_t *before_ticks,
                           int64_t *after_ticks)
 {
+    int64_t overhead = measure_overhead();
     for (size_t i = 0; i < number_measurements; i++) {
-        exec_times[i] = after_ticks[i] - before_ticks[i];
+        int64_t difference = after_ticks[i] - before_ticks[i];
+        if (difference > overhead)
+            exec_times[i] = difference - overhead;
+        else
+            exec_times[i] = difference > 0 ? 1 : difference;
+    }
+}
+
+/* Keep samples of batch, to be written once all batches are done */
+static void keep_samples(worker_t *w, int64_t *exec_times, uint8_t *classes)
+{
+    for (size_t i = 0; i < number_measurements; i++) {
+        if (exec_times[i] <= 0)
+            continue;
+        sample_t *s = &w->samples[w->nsamples++];
+        s->class = classes[i];
+        s->op = w->mode;
+        s->reserved = 0;
+        s->ticks = exec_times[i] > UINT32_MAX ? UINT32_MAX : exec_times[i];
+    }
+}
+
+bool set_samples_file(char *name)
+{
+    if (samples_file)
+        fclose(samples_file);
+    samples_file = NULL;
+    if (!name)
+        return true;
+
+    samples_file = fopen(name, "wb");
+    if (!samples_file)
+        return false;
+    fwrite(SAMPLES_MAGIC, 1, sizeof(SAMPLES_MAGIC) - 1, samples_file);
+    return true;
+}
+
+static int cmp_ticks(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Set the cropping thresholds from the measurements of the calibration
+ * batches.  Threshold i keeps the fastest 1 - 0.5^(10 (i + 1) / 100) of them,
+ * so that most thresholds lie close to the bulk of the distribution.
+ */
+static void prepare_percentiles(int64_t *exec_times, uint8_t *classes, size_t n)
+{
+    double sum[2] = {0.0, 0.0};
+    size_t cnt[2] = {0, 0};
+    size_t valid = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (exec_times[i] <= 0)
+            continue;
+        sum[classes[i]] += exec_times[i];
+        cnt[classes[i]]++;
+        exec_times[valid++] = exec_times[i];
+    }
+    for (int class = 0; class < 2; class ++)
+        centers[class] = cnt[class] ? sum[class] / cnt[class] : 0.0;
+
+    qsort(exec_times, valid, sizeof(int64_t), cmp_ticks);
+    for (size_t i = 0; i < number_percentiles; i++) {
+        double which =
+            1 - pow(0.5, 10 * (double) (i + 1) / number_percentiles);
+        size_t pos = which * valid;
+        percentiles[i] = valid ? exec_times[pos < valid ? pos : valid - 1] : 0;
     }
 }
 
-static void update_statistics(int64_t *exec_times, uint8_t *classes)
+static void update_statistics(t_ctx *ctx, int64_t *exec_times, uint8_t *classes)
 {
     for (size_t i = 0; i < number_measurements; i++) {
         int64_t difference = exec_times[i];
@@ -76,21 +212,68 @@ static void update_statistics(int64_t *exec_times, uint8_t *classes)
             continue;
         }
         /* do a t-test on the execution time */
-        t_push(t, difference, classes[i]);
+        t_push(&ctx[0], difference, classes[i]);
+
+        /* do t-tests on the execution times below each threshold */
+        for (size_t crop = 0; crop < number_percentiles; crop++) {
+            if (difference < percentiles[crop])
+                t_push(&ctx[crop + 1], difference, classes[i]);
+        }
+
+        /* second order test, on the centered squares */
+        double centered = difference - centers[classes[i]];
+        t_push(&ctx[number_tests - 1], centered * centered, classes[i]);
     }
 }
 
-static bool report(void)
+/*
+ * Index of test of largest t value among those with enough measurements of
+ * both classes.  Until there is any, fall back to the uncropped test.
+ */
+static size_t max_test(void)
+{
+    size_t ret = 0;
+    double max = 0;
+    for (size_t i = 0; i < number_tests; i++) {
+        if (t[i].n[0] < enough_class_measurements ||
+            t[i].n[1] < enough_class_measurements)
+            continue;
+        double x = fabs(t_compute(&t[i]));
+        if (max < x) {
+            max = x;
+            ret = i;
+        }
+    }
+    return ret;
+}
+
+/* Describe test i into buf */
+static void test_name(size_t i, char *buf, size_t size)
+{
+    if (i == 0)
+        snprintf(buf, size, "uncropped");
+    else if (i == number_tests - 1)
+        snprintf(buf, size, "second order");
+    else
+        snprintf(buf, size, "cropped at %.1f%%",
+                 100 * (1 - pow(0.5, 10 * (double) i / number_percentiles)));
+}
+
+/* Print statistics, and tell whether they show constant time */
+static bool report(double enough)
 {
-    double max_t = fabs(t_compute(t));
-    double number_traces_max_t = t->n[0] + t->n[1];
+    size_t worst_test = max_test();
+    t_ctx *worst = &t[worst_test];
+    double max_t = fabs(t_compute(worst));
+    double number_traces_max_t = worst->n[0] + worst->n[1];
     double max_tau = max_t / sqrt(number_traces_max_t);
 
     printf("\033[A\033[2K");
-    printf("meas: %7.2lf M, ", (number_traces_max_t / 1e6));
-    if (number_traces_max_t < enough_measurements) {
+    double number_traces = t[0].n[0] + t[0].n[1];
+    printf("meas: %7.2lf M, ", (number_traces / 1e6));
+    if (number_traces < enough) {
         printf("not enough measurements (%.0f still to go).\n",
-               enough_measurements - number_traces_max_t);
+               enough - number_traces);
         return false;
     }
 
@@ -105,8 +288,10 @@ static bool report(void)
      *            detect the leak, if present. "barely detect the
      *            leak" = have a t value greater than 5.
      */
-    printf("max t: %+7.2f, max tau: %.2e, (5/tau)^2: %.2e.\n", max_t, max_tau,
-           (double) (5 * 5) / (double) (max_tau * max_tau));
+    char name[32];
+    test_name(worst_test, name, sizeof(name));
+    printf("max t: %+7.2f (%s), max tau: %.2e, (5/tau)^2: %.2e.\n", max_t,
+           name, max_tau, (double) (5 * 5) / (double) (max_tau * max_tau));
 
     if (max_t > t_threshold_bananas) {
         return false;
@@ -117,12 +302,16 @@ static bool report(void)
     }
 }
 
-static bool doit(int mode)
+static void *doit(void *arg)
 {
+    worker_t *w = arg;
+    /* Calibration keeps the measurements of all its batches */
+    size_t kept = w->calibrate ? w->batches * number_measurements
+                               : number_measurements;
     int64_t *before_ticks = calloc(number_measurements + 1, sizeof(int64_t));
     int64_t *after_ticks = calloc(number_measurements + 1, sizeof(int64_t));
-    int64_t *exec_times = calloc(number_measurements, sizeof(int64_t));
-    uint8_t *classes = calloc(number_measurements, sizeof(uint8_t));
+    int64_t *exec_times = calloc(kept, sizeof(int64_t));
+    uint8_t *classes = calloc(kept, sizeof(uint8_t));
     uint8_t *input_data =
         calloc(number_measurements * chunk_size, sizeof(uint8_t));
 
@@ -131,12 +320,34 @@ static bool doit(int mode)
         die();
     }
 
-    prepare_inputs(input_data, classes);
-
-    measure(before_ticks, after_ticks, input_data, mode);
-    differentiate(exec_times, before_ticks, after_ticks);
-    update_statistics(exec_times, classes);
-    bool ret = report();
+    /* Queues of this thread are not the business of the main one */
+    set_private_mode(true);
+    init_dut();
+    /* Counters are per thread, so each worker opens its own */
+    int ctr = dudect_counter - 1;
+    if (ctr >= 0 && ctr < PCTR_COUNT && perfctr_open() &&
+        perfctr_available(ctr))
+        set_counter(ctr);
+    else
+        set_counter(-1);
+    for (int i = 0; i < number_tests; i++)
+        t_init(&w->t[i]);
+    for (int i = 0; i < w->batches; i++) {
+        size_t offset = w->calibrate ? i * number_measurements : 0;
+        prepare_inputs(input_data, classes + offset);
+        measure(before_ticks, after_ticks, input_data, w->mode);
+        differentiate(exec_times + offset, before_ticks, after_ticks);
+        if (!w->calibrate)
+            update_statistics(w->t, exec_times, classes);
+        if (w->samples)
+            keep_samples(w, exec_times, classes);
+    }
+    if (w->calibrate)
+        prepare_percentiles(exec_times, classes, kept);
+    set_counter(-1);
+    perfctr_close();
+    release_dut();
+    set_private_mode(false);
 
     free(before_ticks);
     free(after_ticks);
@@ -144,52 +355,183 @@ static bool doit(int mode)
     free(classes);
     free(input_data);
 
-    return ret;
+    return NULL;
 }
 
-static void init_once(void)
+/* Start worker pinned to cpu, or unpinned when that fails */
+static bool start_worker(worker_t *w, int cpu)
 {
-    init_dut();
-    t_init(t);
+    pthread_attr_t attr;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    pthread_attr_init(&attr);
+    bool ok = pthread_attr_setaffinity_np(&attr, sizeof(set), &set) == 0 &&
+              pthread_create(&w->tid, &attr, doit, w) == 0;
+    pthread_attr_destroy(&attr);
+    return ok || pthread_create(&w->tid, NULL, doit, w) == 0;
 }
 
-bool is_insert_tail_const(void)
+/*
+ * Run batches of measurements split among worker threads, one per CPU
+ * available, and merge their statistics into t.
+ */
+static void run_workers(int mode, int batches)
 {
-    bool result = false;
-    t = malloc(sizeof(t_ctx));
+    cpu_set_t avail;
+    int cpus[CPU_SETSIZE];
+    int ncpu = 0;
+    if (sched_getaffinity(0, sizeof(avail), &avail) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++)
+            if (CPU_ISSET(c, &avail))
+                cpus[ncpu++] = c;
+    }
+    if (ncpu == 0)
+        cpus[ncpu++] = 0;
 
-    for (int cnt = 0; cnt < test_tries; ++cnt) {
-        printf("Testing insert_tail...(%d/%d)\n\n", cnt, test_tries);
-        init_once();
-        for (int i = 0;
-             i <
-             enough_measurements / (number_measurements - drop_size * 2) + 1;
-             ++i)
-            result = doit(0);
-        printf("\033[A\033[2K\033[A\033[2K");
-        if (result == true)
+    int nthreads = dudect_threads > 0 ? dudect_threads : ncpu;
+    if (nthreads > batches)
+        nthreads = batches;
+
+    worker_t *workers = calloc(nthreads, sizeof(worker_t));
+    if (!workers)
+        die();
+
+    for (int i = 0; i < nthreads; i++) {
+        worker_t *w = &workers[i];
+        w->mode = mode;
+        w->batches = batches / nthreads + (i < batches % nthreads);
+        if (samples_file) {
+            w->samples = calloc(w->batches * number_measurements,
+                                sizeof(sample_t));
+            if (!w->samples)
+                die();
+        }
+        w->running = start_worker(w, cpus[i % ncpu]);
+        if (!w->running)
+            doit(w); /* No thread to spare.  Do it here */
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        if (workers[i].running)
+            pthread_join(workers[i].tid, NULL);
+        for (int j = 0; j < number_tests; j++)
+            t_merge(&t[j], &workers[i].t[j]);
+        /* Measuring is over, so writing cannot disturb it */
+        if (samples_file)
+            fwrite(workers[i].samples, sizeof(sample_t), workers[i].nsamples,
+                   samples_file);
+        free(workers[i].samples);
+    }
+    if (samples_file)
+        fflush(samples_file);
+    free(workers);
+}
+
+/*
+ * Run the batches of one try in rounds, stopping as soon as the verdict is
+ * clear, which is checked after each round.
+ *
+ * A leak is clear once max t passes t_threshold_moderate.  Noise alone
+ * reaches those 10 standard deviations with probability below 1e-20, however
+ * often it is checked.
+ *
+ * Constant time is clear once the test of all the batches could no longer
+ * pass the threshold, bar a deviation of z = sequential_margin standard
+ * deviations.  A t value is the effect tau times sqrt(n), for n measurements,
+ * plus noise of standard deviation 1.  Measured so far are a fraction f of
+ * all of them.  Then:
+ *  - with probability 1 - Phi(-z) at least, |tau| sqrt(n) <= |t| + z, so
+ *    that the effect contributes at most (|t| + z) / sqrt(f) to the final t;
+ *  - the measurements still to come add noise of standard deviation
+ *    sqrt(1 - f), beyond z sqrt(1 - f) with probability 2 Phi(-z) at most.
+ * Stopping when (|t| + z) / sqrt(f) + z sqrt(1 - f) < t_threshold_moderate
+ * thus disagrees with the verdict of the whole try with probability at most
+ * 3 Phi(-z) per check: 0.4% for z = 3, and 3.2% over the sequential_rounds
+ * checks of a try.  Being below max t, every other test meets the bound too.
+ */
+static bool run_sequential(int mode, int batches)
+{
+    int round = (batches + sequential_rounds - 1) / sequential_rounds;
+    double all = batches * (number_measurements - drop_size * 2);
+    double z = sequential_margin;
+    for (int done = 0; done < batches; done += round) {
+        run_workers(mode, round < batches - done ? round : batches - done);
+        double f = (t[0].n[0] + t[0].n[1]) / all;
+        double max_t = fabs(t_compute(&t[max_test()]));
+        if (f >= 1 || max_t > t_threshold_moderate ||
+            (max_t + z) / sqrt(f) + z * sqrt(1 - f) < t_threshold_moderate)
             break;
     }
-    free(t);
-    return result;
+    return report(0);
 }
 
-bool is_size_const(void)
+static bool test_const(int mode)
 {
     bool result = false;
-    t = malloc(sizeof(t_ctx));
+    t = malloc(number_tests * sizeof(t_ctx));
+    worker_t *calibration = calloc(1, sizeof(worker_t));
+    if (!t || !calibration)
+        die();
+    int batches =
+        enough_measurements / (number_measurements - drop_size * 2) + 1;
+
+    /*
+     * Checking that every block freed is allocated walks all blocks of the
+     * pool, which would be timed along with the operations
+     */
+    set_cautious_mode(false);
+    dudect_measurements = 0;
     for (int cnt = 0; cnt < test_tries; ++cnt) {
-        printf("Testing size...(%d/%d)\n\n", cnt, test_tries);
-        init_once();
-        for (int i = 0;
-             i <
-             enough_measurements / (number_measurements - drop_size * 2) + 1;
-             ++i)
-            result = doit(1);
+        printf("Testing %s...(%d/%d)\n\n", dut_ops[mode].name, cnt,
+               test_tries);
+        for (int i = 0; i < number_tests; i++)
+            t_init(&t[i]);
+        calibration->mode = mode;
+        calibration->batches = calibration_batches;
+        calibration->calibrate = true;
+        doit(calibration);
+        if (dudect_sequential)
+            result = run_sequential(mode, batches);
+        else {
+            run_workers(mode, batches);
+            result = report(enough_measurements);
+        }
+        dudect_measurements +=
+            calibration_batches * (number_measurements - drop_size * 2) +
+            t[0].n[0] + t[0].n[1];
         printf("\033[A\033[2K\033[A\033[2K");
         if (result == true)
             break;
     }
+    set_cautious_mode(true);
+    free(calibration);
     free(t);
     return result;
 }
+
+bool is_insert_head_const(void)
+{
+    return test_const(test_insert_head);
+}
+
+bool is_insert_tail_const(void)
+{
+    return test_const(test_insert_tail);
+}
+
+bool is_remove_head_const(void)
+{
+    return test_const(test_remove_head);
+}
+
+bool is_size_const(void)
+{
+    return test_const(test_size);
+}
+
+bool is_new_const(void)
+{
+    return test_const(test_new);
+}
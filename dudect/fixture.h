@@ -2,10 +2,45 @@
 #define DUDECT_FIXTURE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "constant.h"
 
+/* Number of measurement threads.  0 means one per available CPU */
+extern int dudect_threads;
+
+/* Stop each try as soon as its verdict is clear */
+extern int dudect_sequential;
+
+/*
+ * What is measured: 0 for ticks, or 1 + one of the counters of perfctr.h.
+ * Ticks are measured where the counter is not available
+ */
+extern int dudect_counter;
+
+/* Measurements taken by the last test */
+extern size_t dudect_measurements;
+
+/*
+ * Samples file: SAMPLES_MAGIC, followed by one record per measurement
+ * entering the tests.  Fields are in host byte order
+ */
+#define SAMPLES_MAGIC "dudect01"
+
+typedef struct {
+    uint8_t class;
+    uint8_t op; /* One of the operations of constant.h */
+    uint16_t reserved;
+    uint32_t ticks; /* Execution time, saturated */
+} sample_t;
+
+/* Write samples of following tests to file, or stop when name is NULL */
+bool set_samples_file(char *name);
+
 /* Interface to test if function is constant */
+bool is_insert_head_const(void);
 bool is_insert_tail_const(void);
+bool is_remove_head_const(void);
 bool is_size_const(void);
+bool is_new_const(void);
 
 #endif
@@ -0,0 +1,64 @@
+/**
+ * Two-sample Kolmogorov-Smirnov test.
+ *
+ * Tests whether two samples come from the same distribution, comparing
+ * whole distributions rather than means.
+ *
+ * see https://en.wikipedia.org/wiki/Kolmogorov%E2%80%93Smirnov_test
+ *
+ */
+
+#include "kstest.h"
+#include <math.h>
+#include <stdlib.h>
+
+static int cmp_ticks(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+double ks_statistic(int64_t *a, size_t na, int64_t *b, size_t nb)
+{
+    if (!na || !nb)
+        return 0.0;
+
+    qsort(a, na, sizeof(int64_t), cmp_ticks);
+    qsort(b, nb, sizeof(int64_t), cmp_ticks);
+
+    size_t i = 0, j = 0;
+    double d = 0.0;
+    while (i < na && j < nb) {
+        /* Step past every sample of the smallest value left */
+        int64_t x = a[i] < b[j] ? a[i] : b[j];
+        while (i < na && a[i] == x)
+            i++;
+        while (j < nb && b[j] == x)
+            j++;
+        double diff = fabs((double) i / na - (double) j / nb);
+        if (diff > d)
+            d = diff;
+    }
+    return d;
+}
+
+/* Asymptotic distribution, with Stephens' correction for small samples */
+double ks_pvalue(double d, size_t na, size_t nb)
+{
+    if (!na || !nb)
+        return 1.0;
+
+    double ne = (double) na * nb / (na + nb);
+    double lambda = (sqrt(ne) + 0.12 + 0.11 / sqrt(ne)) * d;
+    if (lambda < 0.3)
+        return 1.0;
+
+    double p = 0.0;
+    for (int k = 1; k <= 100; k++) {
+        double term = 2 * exp(-2.0 * k * k * lambda * lambda);
+        p += k % 2 ? term : -term;
+        if (term < 1e-12)
+            break;
+    }
+    return p < 0 ? 0.0 : p > 1 ? 1.0 : p;
+}
@@ -0,0 +1,16 @@
+#ifndef DUDECT_KSTEST_H
+#define DUDECT_KSTEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Largest distance between the empirical distributions of a and b.
+ * Both arrays are sorted in place.
+ */
+double ks_statistic(int64_t *a, size_t na, int64_t *b, size_t nb);
+
+/* Probability of a distance of at least d if a and b had same distribution */
+double ks_pvalue(double d, size_t na, size_t nb);
+
+#endif
@@ -39,6 +39,25 @@ double t_compute(t_ctx *ctx)
     return t_value;
 }
 
+/*
+ * Combine statistics of src into dst, as if all its samples had been
+ * pushed to dst.  Chan et al. parallel variance algorithm
+ * see https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance
+ */
+void t_merge(t_ctx *dst, t_ctx *src)
+{
+    for (int class = 0; class < 2; class ++) {
+        double n = dst->n[class] + src->n[class];
+        if (n == 0)
+            continue;
+        double delta = src->mean[class] - dst->mean[class];
+        dst->mean[class] += delta * src->n[class] / n;
+        dst->m2[class] +=
+            src->m2[class] + delta * delta * dst->n[class] * src->n[class] / n;
+        dst->n[class] = n;
+    }
+}
+
 void t_init(t_ctx *ctx)
 {
     for (int class = 0; class < 2; class ++) {
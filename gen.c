@@ -0,0 +1,235 @@
+/* Random string generator for workloads */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gen.h"
+#include "random.h"
+
+/* Keys of the Zipfian distribution, of which the first are most frequent */
+#define ZIPF_KEYS 1024
+
+/* Most digits of the counter of the ordered distributions, as 26^13 < 2^63 */
+#define ORDER_DIGITS 13
+
+/* One string in that many is out of place in nearly sorted order */
+#define NEARLY_PERIOD 16
+
+typedef enum {
+    GEN_UNIFORM,
+    GEN_ZIPF,
+    GEN_PREFIX,
+    GEN_SORTED,
+    GEN_REVERSE,
+    GEN_NEARLY,
+    GEN_COUNT
+} gen_dist_t;
+
+static char *dist_names[GEN_COUNT] = {
+    [GEN_UNIFORM] = "uniform", [GEN_ZIPF] = "zipf",
+    [GEN_PREFIX] = "prefix",   [GEN_SORTED] = "sorted",
+    [GEN_REVERSE] = "reverse", [GEN_NEARLY] = "nearly",
+};
+
+static gen_dist_t dist = GEN_UNIFORM;
+static int min_len = 5, max_len = 9;
+
+static uint64_t state = 0;
+static bool seeded = false;
+/* Position in the ordered distributions */
+static uint64_t counter = 0;
+/* Cumulative probabilities of the Zipfian keys */
+static double zipf_cdf[ZIPF_KEYS];
+static bool zipf_ready = false;
+
+/* Strings pregenerated by gen_pool */
+static char *pool = NULL;
+static size_t pool_size = 0;
+
+/* wyrand, see https://github.com/wangyi-fudan/wyhash */
+static inline uint64_t next(uint64_t *s)
+{
+    *s += 0xa0761d6478bd642full;
+    __uint128_t t = (__uint128_t) *s * (*s ^ 0xe7037ed1a0b428dbull);
+    return (uint64_t) (t >> 64) ^ (uint64_t) t;
+}
+
+/*
+ * Random letters, eight per random number.  Each byte is scaled to a letter
+ * with a multiplication, so that the inner loop has neither branch nor
+ * division.
+ */
+static void fill_letters(char *s, size_t len, uint64_t *st)
+{
+    while (len > 0) {
+        uint64_t r = next(st);
+        size_t k = len < 8 ? len : 8;
+        for (size_t i = 0; i < k; i++)
+            s[i] = 'a' + (((r >> (8 * i)) & 0xff) * 26 >> 8);
+        s += k;
+        len -= k;
+    }
+}
+
+static size_t random_len(uint64_t *st)
+{
+    return min_len + next(st) % (max_len - min_len + 1);
+}
+
+/* Fixed width string of value, most significant letter first */
+static void fill_ordered(char *s, uint64_t value)
+{
+    int digits = max_len < ORDER_DIGITS ? max_len : ORDER_DIGITS;
+    memset(s, 'a', max_len - digits);
+    for (int i = max_len - 1; i >= max_len - digits; i--) {
+        s[i] = 'a' + value % 26;
+        value /= 26;
+    }
+    s[max_len] = '\0';
+}
+
+static uint64_t ordered_range()
+{
+    int digits = max_len < ORDER_DIGITS ? max_len : ORDER_DIGITS;
+    uint64_t range = 1;
+    for (int i = 0; i < digits; i++)
+        range *= 26;
+    return range;
+}
+
+static void prepare_zipf()
+{
+    double sum = 0;
+    for (int k = 0; k < ZIPF_KEYS; k++) {
+        sum += 1.0 / (k + 1);
+        zipf_cdf[k] = sum;
+    }
+    for (int k = 0; k < ZIPF_KEYS; k++)
+        zipf_cdf[k] /= sum;
+    zipf_ready = true;
+}
+
+/* Rank of a key, drawn with probability proportional to 1 / (rank + 1) */
+static int zipf_rank()
+{
+    if (!zipf_ready)
+        prepare_zipf();
+    double u = (next(&state) >> 11) * 0x1.0p-53;
+    int lo = 0, hi = ZIPF_KEYS - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool gen_set(char *name, int min, int max)
+{
+    if (min < 1 || max < min || max > GEN_MAX_LEN)
+        return false;
+    for (int i = 0; i < GEN_COUNT; i++) {
+        if (!strcmp(name, dist_names[i])) {
+            dist = i;
+            min_len = min;
+            max_len = max;
+            counter = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+char *gen_dist()
+{
+    return dist_names[dist];
+}
+
+int gen_min_len()
+{
+    return min_len;
+}
+
+int gen_max_len()
+{
+    return max_len;
+}
+
+char *gen_dist_names()
+{
+    return "uniform zipf prefix sorted reverse nearly";
+}
+
+size_t gen_slot()
+{
+    return max_len + 1;
+}
+
+void gen_string(char *buf)
+{
+    if (!seeded) {
+        randombytes((uint8_t *) &state, sizeof(state));
+        seeded = true;
+    }
+
+    size_t len;
+    switch (dist) {
+    case GEN_ZIPF: {
+        /* Same key, same string */
+        uint64_t st = zipf_rank() * 0x9e3779b97f4a7c15ull;
+        len = random_len(&st);
+        fill_letters(buf, len, &st);
+        break;
+    }
+    case GEN_PREFIX: {
+        /* All but the last few letters are shared */
+        len = random_len(&state);
+        size_t shared = len > 3 ? len - 3 : 0;
+        memset(buf, 'p', shared);
+        fill_letters(buf + shared, len - shared, &state);
+        break;
+    }
+    case GEN_SORTED:
+        fill_ordered(buf, counter++ % ordered_range());
+        return;
+    case GEN_REVERSE:
+        fill_ordered(buf, ordered_range() - 1 - counter++ % ordered_range());
+        return;
+    case GEN_NEARLY:
+        if (next(&state) % NEARLY_PERIOD)
+            fill_ordered(buf, counter % ordered_range());
+        else
+            fill_ordered(buf, next(&state) % ordered_range());
+        counter++;
+        return;
+    default:
+        len = random_len(&state);
+        fill_letters(buf, len, &state);
+        break;
+    }
+    buf[len] = '\0';
+}
+
+void gen_strings(char *buf, size_t n)
+{
+    size_t slot = gen_slot();
+    for (size_t i = 0; i < n; i++)
+        gen_string(buf + i * slot);
+}
+
+char *gen_pool(size_t n)
+{
+    size_t size = n * gen_slot();
+    if (size > pool_size) {
+        free(pool);
+        pool = malloc(size);
+        pool_size = pool ? size : 0;
+        if (!pool)
+            return NULL;
+    }
+    gen_strings(pool, n);
+    return pool;
+}
@@ -0,0 +1,52 @@
+#ifndef LAB0_GEN_H
+#define LAB0_GEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Generator of the random strings inserted by commands given RAND.
+ *
+ * Strings follow one of several distributions, so that operations can be
+ * exercised on inputs resembling real ones:
+ *   uniform  independent random letters
+ *   zipf     keys drawn with Zipfian frequencies, giving many duplicates
+ *   prefix   random tails after a long prefix shared by all strings
+ *   sorted   strings in ascending order
+ *   reverse  strings in descending order
+ *   nearly   ascending order, with one string in 16 out of place
+ * Lengths are uniform between a minimum and a maximum.  The ordered
+ * distributions use the maximum length for all strings.
+ */
+
+/* Longest string that can be generated */
+#define GEN_MAX_LEN 255
+
+/* Select distribution and lengths.  Return false if they are invalid */
+bool gen_set(char *dist, int min_len, int max_len);
+
+/* Name of the distribution and lengths selected */
+char *gen_dist();
+int gen_min_len();
+int gen_max_len();
+
+/* List of the names of the distributions, separated by spaces */
+char *gen_dist_names();
+
+/* Room needed for one string, including its terminating null */
+size_t gen_slot();
+
+/* Generate next string into buf, of gen_slot() bytes at least */
+void gen_string(char *buf);
+
+/* Generate n strings, in consecutive slots of gen_slot() bytes */
+void gen_strings(char *buf, size_t n);
+
+/*
+ * Generate n strings, in consecutive slots of gen_slot() bytes, into a pool
+ * owned by the generator.  The pool is reused, and overwritten, by the next
+ * call.  Return NULL if it cannot be allocated.
+ */
+char *gen_pool(size_t n);
+
+#endif /* LAB0_GEN_H */
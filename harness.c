@@ -41,8 +41,10 @@ typedef struct BELE {
     /* Also place magic number at tail of every block */
 } block_ele_t;
 
-static block_ele_t *allocated = NULL;
-static size_t allocated_count = 0;
+/* Every thread checks its own blocks */
+static __thread block_ele_t *allocated = NULL;
+static __thread size_t allocated_count = 0;
+static __thread bool private_mode = false;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
@@ -157,6 +159,8 @@ void *test_malloc(size_t size)
         allocated->prev = new_block;
     allocated = new_block;
     allocated_count++;
+    if (!private_mode)
+        note_allocation(size, sizeof(block_ele_t) + sizeof(size_t));
 
     return p;
 }
@@ -206,6 +210,8 @@ void test_free(void *p)
     if (bn)
         bn->prev = bp;
 
+    if (!private_mode)
+        note_free(b->payload_size, sizeof(block_ele_t) + sizeof(size_t));
     free(b);
     allocated_count--;
 }
@@ -248,6 +254,15 @@ void set_noallocate_mode(bool noallocate)
     noallocate_mode = noallocate;
 }
 
+/*
+ * Set/unset private allocation mode of calling thread.
+ * In this mode, blocks are left out of the shared memory accounting.
+ */
+void set_private_mode(bool private)
+{
+    private_mode = private;
+}
+
 /*
  * Return whether any errors have occurred since last time set error limit
  */
@@ -37,6 +37,13 @@ void set_cautious_mode(bool cautious);
  */
 void set_noallocate_mode(bool noallocate);
 
+/*
+ * Set/unset private allocation mode of calling thread.
+ * In this mode, blocks are left out of the shared memory accounting,
+ * as needed by threads running beside the main one.
+ */
+void set_private_mode(bool private);
+
 /*
   Return whether any errors have occurred since last time checked
  */
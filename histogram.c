@@ -0,0 +1,77 @@
+/* Log-linear latency histogram */
+
+#include <math.h>
+#include <string.h>
+
+#include "histogram.h"
+
+static int bucket_index(uint64_t value)
+{
+    if (value < HIST_SUB_BUCKETS)
+        return value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BITS + 1;
+    int sub = value >> shift; /* In [HIST_SUB_BUCKETS / 2, HIST_SUB_BUCKETS) */
+    return HIST_SUB_BUCKETS + (shift - 1) * (HIST_SUB_BUCKETS / 2) +
+           (sub - HIST_SUB_BUCKETS / 2);
+}
+
+/* Middle of the range of values counted in bucket */
+static double bucket_value(int index)
+{
+    if (index < HIST_SUB_BUCKETS)
+        return index;
+
+    int k = index - HIST_SUB_BUCKETS;
+    int shift = k / (HIST_SUB_BUCKETS / 2) + 1;
+    uint64_t sub = k % (HIST_SUB_BUCKETS / 2) + HIST_SUB_BUCKETS / 2;
+    return ldexp(sub + 0.5, shift);
+}
+
+void hist_init(histogram_t *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void hist_record(histogram_t *h, uint64_t value)
+{
+    h->counts[bucket_index(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+}
+
+uint64_t hist_percentile(histogram_t *h, double pct)
+{
+    if (!h->total)
+        return 0;
+
+    uint64_t target = ceil(pct / 100.0 * h->total);
+    if (target < 1)
+        target = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            /* Never report beyond what was really observed */
+            double v = bucket_value(i);
+            if (v > h->max)
+                return h->max;
+            if (v < h->min)
+                return h->min;
+            return v;
+        }
+    }
+    return h->max;
+}
+
+double hist_mean(histogram_t *h)
+{
+    return h->total ? h->sum / h->total : 0.0;
+}
@@ -0,0 +1,35 @@
+#ifndef LAB0_HISTOGRAM_H
+#define LAB0_HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Log-linear histogram of latencies, in the spirit of HdrHistogram.
+ * Values below HIST_SUB_BUCKETS are counted exactly.  Larger values are
+ * grouped by power of two, and each power of two is split into
+ * HIST_SUB_BUCKETS / 2 linear sub-buckets, so that the relative error of
+ * any reported value stays below 2 / HIST_SUB_BUCKETS.
+ */
+
+#define HIST_SUB_BITS 7
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS \
+    (HIST_SUB_BUCKETS + (64 - HIST_SUB_BITS) * (HIST_SUB_BUCKETS / 2))
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total; /* Number of recorded values */
+    uint64_t min, max;
+    double sum;
+} histogram_t;
+
+void hist_init(histogram_t *h);
+
+void hist_record(histogram_t *h, uint64_t value);
+
+/* Value below which pct percent of the recorded values fall */
+uint64_t hist_percentile(histogram_t *h, double pct);
+
+double hist_mean(histogram_t *h);
+
+#endif /* LAB0_HISTOGRAM_H */
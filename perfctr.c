@@ -0,0 +1,103 @@
+/* Performance counters of the calling thread */
+
+#define _GNU_SOURCE
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perfctr.h"
+#include "timing.h"
+
+static struct {
+    char *name;
+    uint64_t config;
+} events[PCTR_COUNT] = {
+    [PCTR_INSTRUCTIONS] = {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+    [PCTR_CYCLES] = {"cycles", PERF_COUNT_HW_CPU_CYCLES},
+    [PCTR_CACHE_REFS] = {"cache-references", PERF_COUNT_HW_CACHE_REFERENCES},
+    [PCTR_CACHE_MISSES] = {"cache-misses", PERF_COUNT_HW_CACHE_MISSES},
+    [PCTR_BRANCH_MISSES] = {"branch-misses", PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+/* Event file descriptors of this thread, -1 when not counting */
+static __thread int fds[PCTR_COUNT] = {-1, -1, -1, -1, -1};
+/* Cycles are counted by the software task clock */
+static __thread bool task_clock = false;
+
+static int open_event(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                   PERF_FLAG_FD_CLOEXEC);
+}
+
+bool perfctr_open()
+{
+    perfctr_close();
+
+    bool any = false;
+    for (int i = 0; i < PCTR_COUNT; i++) {
+        fds[i] = open_event(PERF_TYPE_HARDWARE, events[i].config);
+        any |= fds[i] >= 0;
+    }
+    if (fds[PCTR_CYCLES] < 0) {
+        fds[PCTR_CYCLES] =
+            open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+        task_clock = fds[PCTR_CYCLES] >= 0;
+        any |= task_clock;
+    }
+    return any;
+}
+
+void perfctr_close()
+{
+    for (int i = 0; i < PCTR_COUNT; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+        fds[i] = -1;
+    }
+    task_clock = false;
+}
+
+char *perfctr_name(pctr_t ctr)
+{
+    if (ctr == PCTR_CYCLES && task_clock)
+        return "task-clock";
+    return events[ctr].name;
+}
+
+char *perfctr_unit(pctr_t ctr)
+{
+    if (ctr != PCTR_CYCLES)
+        return "events";
+    if (task_clock)
+        return "ns";
+    return fds[ctr] >= 0 ? "cycles" : "ticks";
+}
+
+bool perfctr_available(pctr_t ctr)
+{
+    return fds[ctr] >= 0;
+}
+
+uint64_t perfctr_read_one(pctr_t ctr)
+{
+    uint64_t value;
+    if (fds[ctr] >= 0 && read(fds[ctr], &value, sizeof(value)) == sizeof(value))
+        return value;
+    return ctr == PCTR_CYCLES ? read_ticks() : 0;
+}
+
+void perfctr_read(uint64_t values[PCTR_COUNT])
+{
+    for (int i = 0; i < PCTR_COUNT; i++)
+        values[i] = perfctr_read_one(i);
+}
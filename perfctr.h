@@ -0,0 +1,45 @@
+#ifndef LAB0_PERFCTR_H
+#define LAB0_PERFCTR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Hardware performance counters of the calling thread, read through
+ * perf_event_open.  Only user space activity is counted.
+ *
+ * Where hardware events are not available (virtual machines, or
+ * restrictive perf_event_paranoid), the cycles counter falls back to the
+ * software task clock, counting nanoseconds, and when even that fails, to
+ * read_ticks of the timing module.  The other counters then read zero.
+ */
+
+typedef enum {
+    PCTR_INSTRUCTIONS,
+    PCTR_CYCLES,
+    PCTR_CACHE_REFS,
+    PCTR_CACHE_MISSES,
+    PCTR_BRANCH_MISSES,
+    PCTR_COUNT
+} pctr_t;
+
+/* Start counting in the calling thread.  Return false if no event counts */
+bool perfctr_open();
+
+/* Stop counting in the calling thread */
+void perfctr_close();
+
+/* Name of counter, and unit it counts in */
+char *perfctr_name(pctr_t ctr);
+char *perfctr_unit(pctr_t ctr);
+
+/* Whether counter is backed by an event of its own */
+bool perfctr_available(pctr_t ctr);
+
+/* Read all counters at once */
+void perfctr_read(uint64_t values[PCTR_COUNT]);
+
+/* Read a single counter.  Cheaper than reading them all */
+uint64_t perfctr_read_one(pctr_t ctr);
+
+#endif /* LAB0_PERFCTR_H */
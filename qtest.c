@@ -1,6 +1,7 @@
 /* Implementation of testing code for queue code */
 
 #include <getopt.h>
+#include <math.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
@@ -12,6 +13,7 @@
 #include <time.h>
 #include <unistd.h>
 #include "dudect/fixture.h"
+#include "dudect/kstest.h"
 
 /* Our program needs to use regular malloc/free */
 #define INTERNAL 1
@@ -31,8 +33,14 @@
  */
 #include "queue.h"
 
+#include "complexity.h"
 #include "console.h"
+#include "gen.h"
+#include "histogram.h"
+#include "replay.h"
 #include "report.h"
+#include "server.h"
+#include "timing.h"
 
 /* Settable parameters */
 
@@ -52,15 +60,37 @@ static queue_t *q = NULL;
 /* Number of elements in queue */
 static size_t qcnt = 0;
 
+/*
+ * Queues known by name.  The current one, which commands operate on, is
+ * held in q and qcnt while it is current.  It is kept for each context of
+ * the console, so that every client session has its own.
+ */
+#define MAX_QUEUES 64
+#define QUEUE_NAME_LEN 16
+
+typedef struct {
+    char name[QUEUE_NAME_LEN];
+    queue_t *q;
+    size_t cnt;
+    /* Harness blocks held by the queue, and by the queue alone when empty */
+    size_t blocks;
+    size_t empty_blocks;
+    /* Harness blocks held by its hash index */
+    size_t index_blocks;
+} named_queue_t;
+
+static named_queue_t queues[MAX_QUEUES] = {{.name = "q"}};
+static int queue_count = 1;
+static int current = 0;
+
 /* How many times can queue operations fail */
 static int fail_limit = BIG_QUEUE;
 static int fail_count = 0;
 
 static int string_length = MAXSTRING;
 
-#define MIN_RANDSTR_LEN 5
-#define MAX_RANDSTR_LEN 10
-static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
+/* Pregenerate the strings inserted for RAND */
+static int randpool = 0;
 
 /* Forward declarations */
 static bool show_queue(int vlevel);
@@ -74,12 +104,36 @@ static bool do_reverse(int argc, char *argv[]);
 static bool do_size(int argc, char *argv[]);
 static bool do_sort(int argc, char *argv[]);
 static bool do_show(int argc, char *argv[]);
+static bool do_mem(int argc, char *argv[]);
+static bool do_complexity(int argc, char *argv[]);
+static bool do_samples(int argc, char *argv[]);
+static bool do_gen(int argc, char *argv[]);
+static bool do_use(int argc, char *argv[]);
+static bool do_concat(int argc, char *argv[]);
+static bool do_splice(int argc, char *argv[]);
+static bool do_merge(int argc, char *argv[]);
+static bool do_dedup(int argc, char *argv[]);
+static bool do_unique(int argc, char *argv[]);
+static bool do_index(int argc, char *argv[]);
+static bool do_contains(int argc, char *argv[]);
+static bool do_count(int argc, char *argv[]);
+static bool do_remove_value(int argc, char *argv[]);
+static bool do_analyze(int argc, char *argv[]);
 
 static void queue_init();
 
 static void console_init()
 {
-    add_cmd("new", do_new, "                | Create new queue");
+    add_cmd("new", do_new,
+            " [name]         | Create new queue, and make it current.  "
+            "(default: current queue)");
+    add_cmd("use", do_use, " name           | Make queue name current");
+    add_cmd("concat", do_concat,
+            " name           | Move all elements of queue name to tail of "
+            "current queue");
+    add_cmd("splice", do_splice,
+            " name           | Move all elements of queue name to head of "
+            "current queue");
     add_cmd("free", do_free, "                | Delete queue");
     add_cmd("ih", do_insert_head,
             " str [n]        | Insert string str at head of queue n times. "
@@ -95,28 +149,212 @@ static void console_init()
         "                | Remove from head of queue without reporting value.");
     add_cmd("reverse", do_reverse, "                | Reverse queue");
     add_cmd("sort", do_sort, "                | Sort queue in ascending order");
+    add_cmd("dedup", do_dedup,
+            "                | Delete all elements of sorted queue whose "
+            "string is duplicated");
+    add_cmd("unique", do_unique,
+            "                | Keep one element of each string in sorted "
+            "queue");
+    add_cmd("index", do_index,
+            " [off]          | Build hash index of strings of queue, or drop "
+            "it");
+    add_cmd("contains", do_contains,
+            " str [n]        | Look up string str in queue n times "
+            "(default: n == 1)");
+    add_cmd("count", do_count,
+            " str [n]        | Count elements holding str n times "
+            "(default: n == 1)");
+    add_cmd("rv", do_remove_value,
+            " str            | Remove an element holding string str");
+    add_cmd("merge", do_merge,
+            " name ...       | Merge sorted queues into sorted current queue, "
+            "leaving them empty");
     add_cmd("size", do_size,
             " [n]            | Compute queue size n times (default: n == 1)");
-    add_cmd("show", do_show, "                | Show queue contents");
+    add_cmd("show", do_show,
+            " [name]         | Show contents of queue name (default: current "
+            "queue)");
+    add_cmd("mem", do_mem,
+            "                | Show memory usage of queue and process");
+    add_cmd("complexity", do_complexity,
+            " op [max]       | Estimate complexity class of operation op "
+            "(insert_head, insert_tail, remove_head, size, new, free, "
+            "reverse, sort) on queues of up to max elements (default: as "
+            "many as fit in the cache)");
+    add_cmd("gen", do_gen,
+            " [dist [min max]] | Show or set distribution of RAND strings "
+            "(uniform, zipf, prefix, sorted, reverse, nearly) and their "
+            "lengths");
+    add_cmd("samples", do_samples,
+            " [file]         | Write raw measurements of simulation to file, "
+            "or stop writing them");
+    add_cmd("analyze", do_analyze,
+            " file           | Show distributions of measurements written by "
+            "samples, and Kolmogorov-Smirnov test of classes");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("randpool", &randpool,
+              "Generate RAND strings before, not during, insertions", NULL);
+    add_param("threads", &dudect_threads,
+              "Number of threads measuring in simulation (0 = one per CPU)",
+              NULL);
+    add_param("counter", &dudect_counter,
+              "Measured in simulation: 0 = ticks, 1 = instructions, "
+              "2 = cycles, 3 = cache references, 4 = cache misses, "
+              "5 = branch misses",
+              NULL);
+    add_param("sequential", &dudect_sequential,
+              "Stop simulation as soon as the verdict is clear", NULL);
 }
 
-static bool do_new(int argc, char *argv[])
+/* Verdict of whole tries on an operation, which sequential mode must match */
+typedef struct {
+    bool (*is_const)(void);
+    bool ok;
+    size_t measurements;
+} verdict_t;
+
+#define MAX_VERDICTS 8
+static verdict_t verdicts[MAX_VERDICTS];
+static int verdict_count = 0;
+
+static verdict_t *find_verdict(bool (*is_const)(void))
+{
+    for (int i = 0; i < verdict_count; i++)
+        if (verdicts[i].is_const == is_const)
+            return &verdicts[i];
+    return NULL;
+}
+
+/* Check in simulation mode that operation runs in constant time */
+static bool simulate(int argc, char *argv[], bool (*is_const)(void))
 {
     if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+        report(1, "%s does not need arguments in simulation mode", argv[0]);
+        return false;
+    }
+    /* dudect prints its progress directly */
+    report_flush();
+    bool ok = is_const();
+    report(2, "%lu measurements used", dudect_measurements);
+    verdict_t *v = find_verdict(is_const);
+    if (!dudect_sequential) {
+        if (!v && verdict_count < MAX_VERDICTS)
+            v = &verdicts[verdict_count++];
+        if (v) {
+            v->is_const = is_const;
+            v->ok = ok;
+            v->measurements = dudect_measurements;
+        }
+    } else if (v) {
+        report(2, "Whole tries used %lu measurements", v->measurements);
+        if (ok != v->ok) {
+            report(1, "ERROR: Stopping early found %s, whole tries found %s",
+                   ok ? "constant time" : "a leak",
+                   v->ok ? "constant time" : "a leak");
+            return false;
+        }
+    }
+    if (!ok) {
+        report(1, "ERROR: Probably not constant time");
         return false;
     }
+    report(1, "Probably constant time");
+    return ok;
+}
+
+/* Index of queue in registry, or -1 if there is none of that name */
+static int find_queue(char *name)
+{
+    for (int i = 0; i < queue_count; i++)
+        if (!strcmp(queues[i].name, name))
+            return i;
+    return -1;
+}
+
+/* Harness blocks held by the queues other than the current one */
+static size_t other_blocks()
+{
+    size_t blocks = 0;
+    for (int i = 0; i < queue_count; i++)
+        if (i != current)
+            blocks += queues[i].blocks;
+    return blocks;
+}
+
+/*
+ * Store current queue into registry.  Only the current queue is operated
+ * on, so blocks allocated beyond those of the other queues are its own.
+ */
+static void save_queue()
+{
+    size_t all = allocation_check(), others = other_blocks();
+    queues[current].q = q;
+    queues[current].cnt = qcnt;
+    queues[current].blocks = all > others ? all - others : 0;
+}
+
+static void switch_queue(int i)
+{
+    save_queue();
+    current = i;
+    q = queues[i].q;
+    qcnt = queues[i].cnt;
+}
+
+/*
+ * Each client session of the server has a current queue of its own, q in a
+ * new one.  The queues themselves are shared by name.
+ */
+static void switch_context(int *state, bool entering)
+{
+    if (entering) {
+        current = *state;
+        q = queues[current].q;
+        qcnt = queues[current].cnt;
+    } else {
+        save_queue();
+        *state = current;
+    }
+}
+
+static bool do_new(int argc, char *argv[])
+{
+    if (simulation)
+        return simulate(argc, argv, is_new_const);
+
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    if (argc == 2) {
+        int i = find_queue(argv[1]);
+        if (i < 0) {
+            if (strlen(argv[1]) >= QUEUE_NAME_LEN) {
+                report(1, "Queue name '%s' is longer than %d characters",
+                       argv[1], QUEUE_NAME_LEN - 1);
+                return false;
+            }
+            if (queue_count == MAX_QUEUES) {
+                report(1, "Cannot have more than %d queues", MAX_QUEUES);
+                return false;
+            }
+            i = queue_count++;
+            memset(&queues[i], 0, sizeof(queues[i]));
+            strcpy(queues[i].name, argv[1]);
+        }
+        switch_queue(i);
+    }
 
     bool ok = true;
     if (q) {
         report(3, "Freeing old queue");
-        ok = do_free(argc, argv);
+        ok = do_free(1, argv);
     }
     error_check();
 
@@ -124,6 +362,9 @@ static bool do_new(int argc, char *argv[])
         q = q_new();
     exception_cancel();
     qcnt = 0;
+    save_queue();
+    queues[current].empty_blocks = queues[current].blocks;
+    queues[current].index_blocks = 0;
     show_queue(3);
 
     return ok && !error_check();
@@ -131,6 +372,17 @@ static bool do_new(int argc, char *argv[])
 
 static bool do_free(int argc, char *argv[])
 {
+    /*
+     * Freeing a queue releases each of its elements, so its time has to
+     * grow with the size of the queue.  No verdict from dudect would tell
+     * anything about the implementation; use complexity instead.
+     */
+    if (simulation) {
+        report(1, "%s is linear in the queue size, try complexity %s",
+               argv[0], argv[0]);
+        return false;
+    }
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -152,35 +404,25 @@ static bool do_free(int argc, char *argv[])
     qcnt = 0;
     show_queue(3);
 
-    size_t bcnt = allocation_check();
-    if (bcnt > 0) {
+    size_t bcnt = allocation_check(), others = other_blocks();
+    if (bcnt > others) {
         report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
-               bcnt);
+               bcnt - others);
         ok = false;
     }
+    save_queue();
+    queues[current].index_blocks = 0;
 
     return ok && !error_check();
 }
-/*
- * TODO: Add a buf_size check of if the buf_size may be less
- * than MIN_RANDSTR_LEN.
- */
-static void fill_rand_string(char *buf, size_t buf_size)
-{
-    size_t len = 0;
-    while (len < MIN_RANDSTR_LEN)
-        len = rand() % buf_size;
-
-    for (size_t n = 0; n < len; n++) {
-        buf[n] = charset[rand() % (sizeof charset - 1)];
-    }
-    buf[len] = '\0';
-}
-
 static bool do_insert_head(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate(argc, argv, is_insert_head_const);
+
     char *lasts = NULL;
-    char randstr_buf[MAX_RANDSTR_LEN];
+    char randstr_buf[GEN_MAX_LEN + 1];
+    char *pool = NULL;
     int reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
@@ -199,6 +441,14 @@ static bool do_insert_head(int argc, char *argv[])
     if (!strcmp(inserts, "RAND")) {
         need_rand = true;
         inserts = randstr_buf;
+        /* Keep generation of the strings out of the timed insertions */
+        if (randpool && reps > 0) {
+            pool = gen_pool(reps);
+            if (!pool) {
+                report(1, "Could not allocate %d random strings", reps);
+                return false;
+            }
+        }
     }
 
     if (!q)
@@ -207,8 +457,10 @@ static bool do_insert_head(int argc, char *argv[])
 
     if (exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            if (pool)
+                inserts = pool + r * gen_slot();
+            else if (need_rand)
+                gen_string(randstr_buf);
             bool rval = q_insert_head(q, inserts);
             if (rval) {
                 qcnt++;
@@ -251,21 +503,11 @@ static bool do_insert_head(int argc, char *argv[])
 
 static bool do_insert_tail(int argc, char *argv[])
 {
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok = is_insert_tail_const();
-        if (!ok) {
-            report(1, "ERROR: Probably not constant time");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
+    if (simulation)
+        return simulate(argc, argv, is_insert_tail_const);
 
-    char randstr_buf[MAX_RANDSTR_LEN];
+    char randstr_buf[GEN_MAX_LEN + 1];
+    char *pool = NULL;
     int reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
@@ -284,6 +526,14 @@ static bool do_insert_tail(int argc, char *argv[])
     if (!strcmp(inserts, "RAND")) {
         need_rand = true;
         inserts = randstr_buf;
+        /* Keep generation of the strings out of the timed insertions */
+        if (randpool && reps > 0) {
+            pool = gen_pool(reps);
+            if (!pool) {
+                report(1, "Could not allocate %d random strings", reps);
+                return false;
+            }
+        }
     }
 
     if (!q)
@@ -292,8 +542,10 @@ static bool do_insert_tail(int argc, char *argv[])
 
     if (exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            if (pool)
+                inserts = pool + r * gen_slot();
+            else if (need_rand)
+                gen_string(randstr_buf);
             bool rval = q_insert_tail(q, inserts);
             if (rval) {
                 qcnt++;
@@ -322,6 +574,9 @@ static bool do_insert_tail(int argc, char *argv[])
 
 static bool do_remove_head(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate(argc, argv, is_remove_head_const);
+
     if (argc != 1 && argc != 2) {
         report(1, "%s needs 0-1 arguments", argv[0]);
         return false;
@@ -470,19 +725,8 @@ static bool do_reverse(int argc, char *argv[])
 
 static bool do_size(int argc, char *argv[])
 {
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok = is_size_const();
-        if (!ok) {
-            report(1, "ERROR: Probably not constant time");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
+    if (simulation)
+        return simulate(argc, argv, is_size_const);
 
     if (argc != 1 && argc != 2) {
         report(1, "%s takes 0-1 arguments", argv[0]);
@@ -531,6 +775,23 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Check that first cnt elements of queue are in ascending order */
+static bool check_sorted(int cnt)
+{
+    if (!q)
+        return true;
+
+    for (list_ele_t *e = q->head; e && e->next && --cnt > 0; e = e->next) {
+        /* Ensure each element in ascending order */
+        /* FIXME: add an option to specify sorting order */
+        if (strcasecmp(e->value, e->next->value) > 0) {
+            report(1, "ERROR: Not sorted in ascending order");
+            return false;
+        }
+    }
+    return true;
+}
+
 bool do_sort(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -553,17 +814,360 @@ bool do_sort(int argc, char *argv[])
     exception_cancel();
     set_noallocate_mode(false);
 
+    bool ok = check_sorted(cnt);
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/* Delete duplicated strings of sorted queue, keeping one of each if keep_one */
+static bool delete_dups(int argc, char *argv[], bool keep_one)
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling %s on null queue", argv[0]);
+    error_check();
+
+    /* Elements expected to be left, counting runs of equal strings */
+    size_t expected = 0;
+    bool sorted = true;
+    if (q) {
+        list_ele_t *e = q->head;
+        while (e) {
+            list_ele_t *run = e;
+            size_t len = 0;
+            for (; e && !strcmp(e->value, run->value); e = e->next)
+                len++;
+            if (e && strcmp(run->value, e->value) > 0)
+                sorted = false;
+            if (keep_one || len == 1)
+                expected++;
+        }
+        if (!sorted)
+            report(3, "Warning: Calling %s on unsorted queue", argv[0]);
+    }
+
+    mem_stat_t before, after;
+    mem_stat(&before);
+    bool rval = false;
+    if (qcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        rval = keep_one ? q_unique(q) : q_delete_dup(q);
+    exception_cancel();
+    set_cautious_mode(true);
+    mem_stat(&after);
+
     bool ok = true;
+    if (after.allocate_cnt != before.allocate_cnt) {
+        report(1, "ERROR: %s allocated %lu blocks", argv[0],
+               after.allocate_cnt - before.allocate_cnt);
+        ok = false;
+    }
     if (q) {
-        for (list_ele_t *e = q->head; e && --cnt; e = e->next) {
-            /* Ensure each element in ascending order */
-            /* FIXME: add an option to specify sorting order */
-            if (strcasecmp(e->value, e->next->value) > 0) {
-                report(1, "ERROR: Not sorted in ascending order");
+        if (!rval) {
+            report(1, "ERROR: %s failed on non-null queue", argv[0]);
+            ok = false;
+        }
+        /* Each deleted element frees itself and its string */
+        size_t deleted = qcnt - expected;
+        size_t frees = after.free_cnt - before.free_cnt;
+        if (rval && frees != 2 * deleted) {
+            report(1, "ERROR: %s deleted %lu elements, but freed %lu blocks",
+                   argv[0], deleted, frees);
+            ok = false;
+        } else {
+            report(3, "Deleted %lu elements, freeing %lu blocks", deleted,
+                   frees);
+        }
+        qcnt = expected;
+        if (ok && q_size(q) != qcnt) {
+            report(1, "ERROR: Queue size is %d after %s, but should be %lu",
+                   q_size(q), argv[0], qcnt);
+            ok = false;
+        }
+        for (list_ele_t *e = q->head; ok && e && e->next; e = e->next) {
+            if (!strcmp(e->value, e->next->value)) {
+                report(1, "ERROR: Duplicate string %s left after %s",
+                       e->value, argv[0]);
                 ok = false;
-                break;
             }
         }
+        ok = ok && (!sorted || check_sorted(qcnt));
+    } else if (rval) {
+        report(1, "ERROR: %s succeeded on null queue", argv[0]);
+        ok = false;
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_dedup(int argc, char *argv[])
+{
+    return delete_dups(argc, argv, false);
+}
+
+static bool do_unique(int argc, char *argv[])
+{
+    return delete_dups(argc, argv, true);
+}
+
+/* Describe hash index of current queue into buf */
+static void index_note(char *buf, size_t size)
+{
+    size_t bytes = q_index_bytes(q);
+    if (bytes == 0)
+        snprintf(buf, size, "no index");
+    else if (qcnt == 0)
+        snprintf(buf, size, "index of %lu bytes", bytes);
+    else
+        snprintf(buf, size, "index of %.1f bytes/element",
+                 (double) bytes / qcnt);
+}
+
+/* Number of elements of current queue holding s, by walking it */
+static int count_value(char *s)
+{
+    int cnt = 0;
+    size_t n = 0;
+    for (list_ele_t *e = q ? q->head : NULL; e && n < qcnt; e = e->next, n++)
+        cnt += !strcmp(e->value, s);
+    return cnt;
+}
+
+static bool do_index(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    bool drop = argc == 2;
+    if (drop && strcmp(argv[1], "off")) {
+        report(1, "Invalid argument '%s'", argv[1]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling index on null queue");
+    error_check();
+
+    size_t blocks = allocation_check();
+    bool rval = true;
+    uint64_t ticks = 0;
+    if (exception_setup(true)) {
+        uint64_t start = read_ticks_begin();
+        if (drop)
+            q_unindex(q);
+        else
+            rval = q_index(q);
+        ticks = read_ticks_end() - start;
+    }
+    exception_cancel();
+
+    /* Blocks of index are left with queue when its elements move away */
+    named_queue_t *nq = &queues[current];
+    nq->index_blocks += allocation_check() - blocks;
+    if (drop) {
+        nq->index_blocks = 0;
+    } else if (!rval) {
+        if (q)
+            report(2, "Could not build index");
+    } else {
+        char note[64];
+        index_note(note, sizeof(note));
+        report(2, "Indexed %lu elements in %.1f us, %s", qcnt,
+               ticks_to_ns(ticks) / 1000, note);
+    }
+
+    show_queue(3);
+    return !error_check();
+}
+
+/* Look up string n times, counting its elements if count */
+static bool lookup(int argc, char *argv[], bool count)
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    int reps = 1;
+    if (argc == 3 && (!get_int(argv[2], &reps) || reps < 1)) {
+        report(1, "Invalid number of lookups '%s'", argv[2]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling %s on null queue", argv[0]);
+    error_check();
+
+    int expected = count_value(argv[1]);
+    int result = 0;
+    uint64_t ticks = 0;
+    if (exception_setup(true)) {
+        uint64_t start = read_ticks_begin();
+        for (int r = 0; r < reps; r++)
+            result = count ? q_count(q, argv[1]) : q_contains(q, argv[1]);
+        ticks = read_ticks_end() - start;
+    }
+    exception_cancel();
+
+    bool ok = true;
+    char note[64];
+    index_note(note, sizeof(note));
+    double ns = ticks_to_ns(ticks) / reps;
+    if (count) {
+        if (result != expected) {
+            report(1, "ERROR: Counted %d elements holding %s, but there are %d",
+                   result, argv[1], expected);
+            ok = false;
+        } else {
+            report(2, "Counted %d elements holding %s, %.1f ns per call, %s",
+                   result, argv[1], ns, note);
+        }
+    } else {
+        if (result != (expected > 0)) {
+            report(1, "ERROR: %s %s, but %d elements hold it",
+                   result ? "Found" : "Did not find", argv[1], expected);
+            ok = false;
+        } else {
+            report(2, "%s %s, %.1f ns per call, %s",
+                   result ? "Found" : "Did not find", argv[1], ns, note);
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_contains(int argc, char *argv[])
+{
+    return lookup(argc, argv, false);
+}
+
+static bool do_count(int argc, char *argv[])
+{
+    return lookup(argc, argv, true);
+}
+
+static bool do_remove_value(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling remove value on null queue");
+    error_check();
+
+    int before = count_value(argv[1]);
+    bool rval = false;
+    uint64_t ticks = 0;
+    if (qcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true)) {
+        uint64_t start = read_ticks_begin();
+        rval = q_remove_value(q, argv[1]);
+        ticks = read_ticks_end() - start;
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+
+    bool ok = true;
+    if (rval)
+        qcnt--;
+    if (rval && before == 0) {
+        report(1, "ERROR: Removed %s, but no element held it", argv[1]);
+        ok = false;
+    } else if (!rval && before > 0) {
+        report(1, "ERROR: Failed to remove %s, held by %d elements", argv[1],
+               before);
+        ok = false;
+    } else if (rval && count_value(argv[1]) != before - 1) {
+        report(1, "ERROR: %d elements hold %s after removal, but should be %d",
+               count_value(argv[1]), argv[1], before - 1);
+        ok = false;
+    } else if (q_size(q) != qcnt) {
+        report(1, "ERROR: Queue size is %d after removal, but should be %lu",
+               q_size(q), qcnt);
+        ok = false;
+    } else {
+        char note[64];
+        index_note(note, sizeof(note));
+        report(2, "%s %s, %.1f ns, %s", rval ? "Removed" : "Did not find",
+               argv[1], ticks_to_ns(ticks), note);
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_merge(int argc, char *argv[])
+{
+    if (argc < 2) {
+        report(1, "%s needs at least 1 argument", argv[0]);
+        return false;
+    }
+
+    /* Current queue first, then those merged into it */
+    int k = argc;
+    int idx[k];
+    queue_t *qs[k];
+    idx[0] = current;
+    qs[0] = q;
+    for (int i = 1; i < k; i++) {
+        idx[i] = find_queue(argv[i]);
+        if (idx[i] < 0) {
+            report(1, "No queue named '%s'", argv[i]);
+            return false;
+        }
+        for (int j = 0; j < i; j++) {
+            if (idx[j] == idx[i]) {
+                report(1, "Cannot merge queue %s with itself", argv[i]);
+                return false;
+            }
+        }
+        qs[i] = queues[idx[i]].q;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling merge on null queue");
+    error_check();
+
+    /* Only the index of q, if any, may have to grow */
+    set_noallocate_mode(q_index_bytes(q) == 0);
+    if (exception_setup(true))
+        q_merge_sorted(qs, k);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (q) {
+        /* Elements, and the blocks holding them, now belong to q */
+        for (int i = 1; i < k; i++) {
+            named_queue_t *src = &queues[idx[i]];
+            if (!src->q)
+                continue;
+            qcnt += src->cnt;
+            src->cnt = 0;
+            src->blocks = src->empty_blocks + src->index_blocks;
+            if (q_size(src->q) != 0 || src->q->head) {
+                report(1, "ERROR: Queue %s is not empty after merge",
+                       src->name);
+                ok = false;
+            }
+        }
+        if (ok && q_size(q) != qcnt) {
+            report(1, "ERROR: Queue size is %d after merge, but should be %lu",
+                   q_size(q), qcnt);
+            ok = false;
+        }
+        ok = ok && check_sorted(qcnt);
     }
 
     show_queue(3);
@@ -578,11 +1182,11 @@ static bool show_queue(int vlevel)
 
     int cnt = 0;
     if (!q) {
-        report(vlevel, "q = NULL");
+        report(vlevel, "%s = NULL", queues[current].name);
         return true;
     }
 
-    report_noreturn(vlevel, "q = [");
+    report_noreturn(vlevel, "%s = [", queues[current].name);
     list_ele_t *e = q->head;
     if (exception_setup(true)) {
         while (ok && e && cnt < qcnt) {
@@ -618,12 +1222,502 @@ static bool show_queue(int vlevel)
 }
 
 static bool do_show(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 1)
+        return show_queue(0);
+
+    int i = find_queue(argv[1]);
+    if (i < 0) {
+        report(1, "No queue named '%s'", argv[1]);
+        return false;
+    }
+    int prev = current;
+    switch_queue(i);
+    bool ok = show_queue(0);
+    switch_queue(prev);
+    return ok;
+}
+
+static bool do_use(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int i = find_queue(argv[1]);
+    if (i < 0) {
+        report(1, "No queue named '%s'", argv[1]);
+        return false;
+    }
+    switch_queue(i);
+    show_queue(3);
+    return true;
+}
+
+/* Move all elements of queue named by argv[1] into current queue */
+static bool move_queue(int argc, char *argv[], bool to_head)
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int i = find_queue(argv[1]);
+    if (i < 0) {
+        report(1, "No queue named '%s'", argv[1]);
+        return false;
+    }
+    if (i == current) {
+        report(1, "Cannot %s queue %s with itself", argv[0], argv[1]);
+        return false;
+    }
+
+    named_queue_t *src = &queues[i];
+    if (!q || !src->q)
+        report(3, "Warning: Calling %s on null queue", argv[0]);
+    error_check();
+
+    /* Only the index of q, if any, may have to grow */
+    set_noallocate_mode(q_index_bytes(q) == 0);
+    if (exception_setup(true)) {
+        if (to_head)
+            q_splice(q, src->q);
+        else
+            q_concat(q, src->q);
+    }
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (q && src->q) {
+        /* Elements, and the blocks holding them, now belong to q */
+        qcnt += src->cnt;
+        src->cnt = 0;
+        src->blocks = src->empty_blocks + src->index_blocks;
+        if (q_size(src->q) != 0 || src->q->head) {
+            report(1, "ERROR: Queue %s is not empty after %s", src->name,
+                   argv[0]);
+            ok = false;
+        } else if (q_size(q) != qcnt) {
+            report(1, "ERROR: Queue size is %d after %s, but should be %lu",
+                   q_size(q), argv[0], qcnt);
+            ok = false;
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_concat(int argc, char *argv[])
+{
+    return move_queue(argc, argv, false);
+}
+
+static bool do_splice(int argc, char *argv[])
+{
+    return move_queue(argc, argv, true);
+}
+
+/* Resident set size of process in bytes, or -1 when unknown */
+static long resident_bytes()
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f)
+        return -1;
+
+    long size, resident;
+    int n = fscanf(f, "%ld %ld", &size, &resident);
+    fclose(f);
+    if (n != 2)
+        return -1;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static bool do_mem(int argc, char *argv[])
 {
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
-    return show_queue(0);
+
+    mem_stat_t st;
+    mem_stat(&st);
+    report(1, "Live bytes:       %lu (peak %lu)", st.current_bytes,
+           st.peak_bytes);
+    report(1, "Allocations:      %lu, frees: %lu, bytes allocated: %lu",
+           st.allocate_cnt, st.free_cnt, st.allocate_bytes);
+    report(1, "Queue blocks:     %lu", st.harness_blocks);
+    report(1, "Queue payload:    %lu bytes", st.harness_payload);
+    report(1, "Harness overhead: %lu bytes", st.harness_overhead);
+    save_queue();
+    size_t elements = 0;
+    for (int i = 0; i < queue_count; i++)
+        elements += queues[i].cnt;
+    if (elements > 0) {
+        size_t queue_bytes = st.harness_payload + st.harness_overhead;
+        report(1, "Bytes/element:    %.1f (%.1f payload, %.1f overhead)",
+               (double) queue_bytes / elements,
+               (double) st.harness_payload / elements,
+               (double) st.harness_overhead / elements);
+    }
+    if (queue_count > 1) {
+        for (int i = 0; i < queue_count; i++)
+            report(1, "Queue %s: %lu elements, %lu blocks", queues[i].name,
+                   queues[i].cnt, queues[i].blocks);
+    }
+
+    long rss = resident_bytes();
+    if (rss < 0)
+        report(1, "RSS:              unknown");
+    else
+        report(1, "RSS:              %ld bytes", rss);
+    return true;
+}
+
+/*
+ * Sizes of queues timed by complexity: COMPLEXITY_POINTS sizes doubling up
+ * to the largest one, so spanning three decades.  Over a narrower range,
+ * n and n log n are hard to tell apart.  By default the largest queue takes
+ * half of the L2 cache, of COMPLEXITY_L2_BYTES if unknown, counting
+ * COMPLEXITY_ELEMENT_BYTES for an element, its string and what the harness
+ * and malloc add to both.  Queues that do not fit are several times slower
+ * per element, which no model accounts for.
+ */
+#define COMPLEXITY_POINTS 11
+#define COMPLEXITY_L2_BYTES 1048576
+#define COMPLEXITY_ELEMENT_BYTES 128
+/* Runs per size, after one to warm up the allocator.  The median is kept */
+#define COMPLEXITY_RUNS 7
+
+static int cmp_ticks(const void *a, const void *b)
+{
+    int64_t ta = *(const int64_t *) a, tb = *(const int64_t *) b;
+    return (ta > tb) - (ta < tb);
+}
+
+/* Largest queue fitting in half of the L2 cache */
+static int complexity_cached_size()
+{
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 <= 0)
+        l2 = COMPLEXITY_L2_BYTES;
+    return l2 / 2 / COMPLEXITY_ELEMENT_BYTES;
+}
+
+/*
+ * Median time in ns of op on queues of size elements.  It is measured in a
+ * child process, so that a crash, such as a recursive sort overflowing the
+ * stack on a long queue, only ends that.  Return false if it failed, with
+ * the status of the child in status.
+ */
+static bool complexity_time(const dut_op_t *op,
+                            int size,
+                            double *t,
+                            int *status)
+{
+    int fds[2];
+    *status = 0;
+    if (pipe(fds) < 0)
+        return false;
+    report_flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        int sizes[COMPLEXITY_RUNS], slots[COMPLEXITY_RUNS] = {0};
+        int64_t before_ticks[COMPLEXITY_RUNS], after_ticks[COMPLEXITY_RUNS];
+        int64_t ticks[COMPLEXITY_RUNS];
+
+        close(fds[0]);
+        /* Checking every free against all blocks would be quadratic */
+        set_cautious_mode(false);
+        init_dut();
+        prepare_strings();
+        for (int r = 0; r < COMPLEXITY_RUNS; r++)
+            sizes[r] = size;
+        op->measure(before_ticks, after_ticks, sizes, slots, 0, 1);
+        op->measure(before_ticks, after_ticks, sizes, slots, 0,
+                    COMPLEXITY_RUNS);
+        for (int r = 0; r < COMPLEXITY_RUNS; r++)
+            ticks[r] = after_ticks[r] - before_ticks[r] - measure_overhead();
+        qsort(ticks, COMPLEXITY_RUNS, sizeof(int64_t), cmp_ticks);
+
+        int64_t median = ticks[COMPLEXITY_RUNS / 2];
+        double ns = ticks_to_ns(median > 0 ? median : 1);
+        bool ok = write(fds[1], &ns, sizeof(ns)) == sizeof(ns);
+        _exit(ok ? 0 : 1);
+    }
+
+    close(fds[1]);
+    bool ok = read(fds[0], t, sizeof(*t)) == sizeof(*t);
+    close(fds[0]);
+    waitpid(pid, status, 0);
+    return ok && WIFEXITED(*status) && WEXITSTATUS(*status) == 0;
+}
+
+static bool do_complexity(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    const dut_op_t *op = NULL;
+    for (int m = 0; m < test_count; m++)
+        if (!strcmp(argv[1], dut_ops[m].name))
+            op = &dut_ops[m];
+    if (!op) {
+        report(1, "Unknown operation '%s'", argv[1]);
+        return false;
+    }
+
+    int cached_size = complexity_cached_size();
+    int max_size = cached_size;
+    int min_ratio = 1 << (COMPLEXITY_POINTS - 1);
+    if (argc == 3 && !get_int(argv[2], &max_size)) {
+        report(1, "Invalid maximum size '%s'", argv[2]);
+        return false;
+    }
+    if (max_size < 2 * min_ratio) {
+        report(1, "Maximum size must be at least %d", 2 * min_ratio);
+        return false;
+    }
+    if (max_size > cached_size)
+        report(1, "Warning: Queues over %d elements do not fit in the cache",
+               cached_size);
+
+    /* Calibrated once, so that no child has to */
+    measure_overhead();
+
+    double n[COMPLEXITY_POINTS], t[COMPLEXITY_POINTS];
+    int k;
+    for (k = 0; k < COMPLEXITY_POINTS; k++) {
+        int size = max_size / (double) min_ratio * (1 << k) + 0.5;
+        int status;
+        if (!complexity_time(op, size, &t[k], &status)) {
+            if (WIFSIGNALED(status))
+                report(1, "%s crashed on %d elements: %s", op->name, size,
+                       strsignal(WTERMSIG(status)));
+            else
+                report(1, "Could not time %s on %d elements", op->name,
+                       size);
+            break;
+        }
+        n[k] = size;
+        report(2, "n = %7d: %12.0f ns", size, t[k]);
+    }
+    if (k < 4) {
+        report(1, "Too few sizes timed to estimate complexity of %s",
+               op->name);
+        return false;
+    }
+    if (k < COMPLEXITY_POINTS)
+        report(1, "Estimating from the %d smaller sizes", k);
+
+    fit_t fits[O_COUNT];
+    fit_complexity(n, t, k, fits);
+    for (int i = 0; i < O_COUNT; i++) {
+        if (isinf(fits[i].aic))
+            report(2, "%-11s no significant growth", order_name(fits[i].order));
+        else
+            report(2, "%-11s error %6.1f%%, R^2 = %.3f, %.0f + %.3g f(n) ns",
+                   order_name(fits[i].order), fits[i].err * 100, fits[i].r2,
+                   fits[i].a, fits[i].b);
+    }
+    int rivals = fit_rivals(fits);
+    if (rivals > 0) {
+        char names[64] = "";
+        for (int i = 0; i <= rivals; i++)
+            snprintf(names + strlen(names), sizeof(names) - strlen(names),
+                     "%s%s", i == 0 ? "" : i == rivals ? " or " : ", ",
+                     order_name(fits[i].order));
+        report(1, "%s is %s, which these sizes cannot tell apart", op->name,
+               names);
+    } else {
+        report(1, "%s is probably %s (confidence %.0f%%)", op->name,
+               order_name(fits[0].order), fit_confidence(fits) * 100);
+    }
+    return true;
+}
+
+static bool do_gen(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2 && argc != 4) {
+        report(1, "%s takes 0, 1 or 3 arguments", argv[0]);
+        return false;
+    }
+
+    if (argc > 1) {
+        int min_len = gen_min_len(), max_len = gen_max_len();
+        if (argc == 4 &&
+            (!get_int(argv[2], &min_len) || !get_int(argv[3], &max_len))) {
+            report(1, "Invalid lengths '%s' '%s'", argv[2], argv[3]);
+            return false;
+        }
+        if (!gen_set(argv[1], min_len, max_len)) {
+            report(1,
+                   "Invalid distribution '%s' or lengths %d-%d.  "
+                   "Distributions are %s, lengths from 1 to %d",
+                   argv[1], min_len, max_len, gen_dist_names(), GEN_MAX_LEN);
+            return false;
+        }
+    }
+    report(1, "Distribution %s, lengths %d-%d", gen_dist(), gen_min_len(),
+           gen_max_len());
+    return true;
+}
+
+static bool do_samples(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    if (!set_samples_file(argc == 2 ? argv[1] : NULL)) {
+        report(1, "Cannot open samples file '%s'", argv[1]);
+        return false;
+    }
+    return true;
+}
+
+/* Bins of distributions shown by analyze, and width of their bars */
+#define ANALYZE_BINS 16
+#define ANALYZE_BAR 30
+
+/* Print distributions of the two classes side by side */
+static void show_distributions(int64_t *ticks[2], size_t cnt[2])
+{
+    histogram_t *hist = malloc(sizeof(histogram_t));
+    if (!hist)
+        return;
+
+    /* Leave out the tails, which would squeeze the rest into a bin */
+    hist_init(hist);
+    for (int c = 0; c < 2; c++)
+        for (size_t i = 0; i < cnt[c]; i++)
+            hist_record(hist, ticks[c][i]);
+    uint64_t lo = hist_percentile(hist, 1.0);
+    uint64_t hi = hist_percentile(hist, 99.0) + 1;
+    uint64_t width = (hi - lo + ANALYZE_BINS - 1) / ANALYZE_BINS;
+    if (!width)
+        width = 1;
+
+    for (int c = 0; c < 2; c++) {
+        hist_init(hist);
+        for (size_t i = 0; i < cnt[c]; i++)
+            hist_record(hist, ticks[c][i]);
+        report(1,
+               "  class %d: %8lu samples, mean %8.1f, p50 %6lu, p90 %6lu, "
+               "p99 %6lu, max %lu",
+               c, cnt[c], hist_mean(hist), hist_percentile(hist, 50.0),
+               hist_percentile(hist, 90.0), hist_percentile(hist, 99.0),
+               hist->max);
+    }
+    free(hist);
+
+    size_t bins[2][ANALYZE_BINS] = {{0}};
+    for (int c = 0; c < 2; c++)
+        for (size_t i = 0; i < cnt[c]; i++)
+            if (ticks[c][i] >= lo && ticks[c][i] < lo + width * ANALYZE_BINS)
+                bins[c][(ticks[c][i] - lo) / width]++;
+    for (int b = 0; b < ANALYZE_BINS; b++) {
+        char bar[2][ANALYZE_BAR + 1];
+        /* Full bar for a quarter of the class or more */
+        for (int c = 0; c < 2; c++) {
+            int len = cnt[c] ? ANALYZE_BAR * 4 * bins[c][b] / cnt[c] : 0;
+            if (len > ANALYZE_BAR)
+                len = ANALYZE_BAR;
+            memset(bar[c], '#', len);
+            bar[c][len] = '\0';
+        }
+        report(1, "  %6lu-%-6lu %-*s | %s", lo + b * width,
+               lo + (b + 1) * width - 1, ANALYZE_BAR, bar[0], bar[1]);
+    }
+}
+
+static bool do_analyze(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    char magic[sizeof(SAMPLES_MAGIC) - 1];
+    if (!f || fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        memcmp(magic, SAMPLES_MAGIC, sizeof(magic))) {
+        report(1, "'%s' is not a samples file", argv[1]);
+        if (f)
+            fclose(f);
+        return false;
+    }
+
+    sample_t *samples = NULL;
+    size_t nsamples = 0, room = 0;
+    for (;;) {
+        if (nsamples == room) {
+            room = room ? room * 2 : 4096;
+            sample_t *more = realloc(samples, room * sizeof(sample_t));
+            if (!more) {
+                report(1, "Cannot allocate room for samples of '%s'",
+                       argv[1]);
+                break;
+            }
+            samples = more;
+        }
+        size_t got =
+            fread(samples + nsamples, sizeof(sample_t), room - nsamples, f);
+        nsamples += got;
+        if (nsamples < room) {
+            if (ferror(f))
+                report(1, "Error reading '%s'", argv[1]);
+            break;
+        }
+    }
+    /* Leave no sample out of analysis */
+    bool complete = nsamples < room && !ferror(f);
+    fclose(f);
+    if (!complete) {
+        free(samples);
+        return false;
+    }
+
+    int64_t *ticks[2] = {malloc((nsamples + 1) * sizeof(int64_t)),
+                         malloc((nsamples + 1) * sizeof(int64_t))};
+    bool ok = ticks[0] && ticks[1];
+    for (int op = 0; ok && op < test_count; op++) {
+        size_t cnt[2] = {0, 0};
+        for (size_t i = 0; i < nsamples; i++)
+            if (samples[i].op == op && samples[i].class < 2)
+                ticks[samples[i].class][cnt[samples[i].class]++] =
+                    samples[i].ticks;
+        if (!cnt[0] && !cnt[1])
+            continue;
+
+        report(1, "%s:", dut_ops[op].name);
+        show_distributions(ticks, cnt);
+        double d = ks_statistic(ticks[0], cnt[0], ticks[1], cnt[1]);
+        double p = ks_pvalue(d, cnt[0], cnt[1]);
+        report(1, "  Kolmogorov-Smirnov distance %.4f, p-value %.3g: %s", d, p,
+               p < 0.001 ? "classes differ" : "no difference found");
+    }
+    if (!ok)
+        report(1, "Cannot allocate room for %lu samples", nsamples);
+
+    free(ticks[0]);
+    free(ticks[1]);
+    free(samples);
+    return ok;
 }
 
 /* Signal handlers */
@@ -632,6 +1726,7 @@ static void sigsegvhandler(int sig)
     report(1,
            "Segmentation fault occurred.  You dereferenced a NULL or invalid "
            "pointer");
+    report_flush();
     /* Raising a SIGABRT signal to produce a core dump for debugging. */
     abort();
 }
@@ -647,20 +1742,24 @@ static void queue_init()
 {
     fail_count = 0;
     q = NULL;
+    set_context_hook(switch_context);
     signal(SIGSEGV, sigsegvhandler);
     signal(SIGALRM, sigalrmhandler);
 }
 
 static bool queue_quit(int argc, char *argv[])
 {
-    report(3, "Freeing queue");
-    if (qcnt > big_queue_size)
-        set_cautious_mode(false);
-
-    if (exception_setup(true))
-        q_free(q);
-    exception_cancel();
-    set_cautious_mode(true);
+    save_queue();
+    for (int i = 0; i < queue_count; i++) {
+        report(3, "Freeing queue %s", queues[i].name);
+        if (queues[i].cnt > big_queue_size)
+            set_cautious_mode(false);
+
+        if (exception_setup(true))
+            q_free(queues[i].q);
+        exception_cancel();
+        set_cautious_mode(true);
+    }
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -674,11 +1773,27 @@ static bool queue_quit(int argc, char *argv[])
 
 static void usage(char *cmd)
 {
-    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE]\n", cmd);
+    printf(
+        "Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE][-c CFILE]"
+        "[-S SOCK][-b]\n"
+        "          [-m MFILE]\n",
+        cmd);
     printf("\t-h         Print this information\n");
     printf("\t-f IFILE   Read commands from IFILE\n");
     printf("\t-v VLEVEL  Set verbosity level\n");
     printf("\t-l LFILE   Echo results to LFILE\n");
+    printf(
+        "\t-c CFILE   Replay compiled trace CFILE, "
+        "compiling it from IFILE first\n"
+        "\t           if -f is given\n");
+    printf("\t-S SOCK    Serve commands to clients on Unix socket SOCK\n");
+    printf(
+        "\t-b         Buffer output and write it from a background "
+        "thread\n");
+    printf(
+        "\t-m MFILE   Write metrics of each command to MFILE, as CSV\n"
+        "\t           if named *.csv, else as JSON Lines\n"
+        "\t           (CSV summary goes to *.summary.csv)\n");
     exit(0);
 }
 
@@ -726,10 +1841,17 @@ int main(int argc, char *argv[])
     char *infile_name = NULL;
     char lbuf[BUFSIZE];
     char *logfile_name = NULL;
+    char cbuf[BUFSIZE];
+    char *compiled_name = NULL;
+    char sbuf[BUFSIZE];
+    char *socket_name = NULL;
     int level = 4;
+    bool buffer_output = false;
+    char mbuf[BUFSIZE];
+    char *metrics_name = NULL;
     int c;
 
-    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
+    while ((c = getopt(argc, argv, "hv:f:l:c:S:bm:")) != -1) {
         switch (c) {
         case 'h':
             usage(argv[0]);
@@ -747,6 +1869,24 @@ int main(int argc, char *argv[])
             buf[BUFSIZE - 1] = '\0';
             logfile_name = lbuf;
             break;
+        case 'c':
+            strncpy(cbuf, optarg, BUFSIZE);
+            cbuf[BUFSIZE - 1] = '\0';
+            compiled_name = cbuf;
+            break;
+        case 'S':
+            strncpy(sbuf, optarg, BUFSIZE);
+            sbuf[BUFSIZE - 1] = '\0';
+            socket_name = sbuf;
+            break;
+        case 'b':
+            buffer_output = true;
+            break;
+        case 'm':
+            strncpy(mbuf, optarg, BUFSIZE);
+            mbuf[BUFSIZE - 1] = '\0';
+            metrics_name = mbuf;
+            break;
         default:
             printf("Unknown option '%c'\n", c);
             usage(argv[0]);
@@ -755,6 +1895,7 @@ int main(int argc, char *argv[])
     }
 
     srand((unsigned int) (time(NULL)));
+    timing_init();
     queue_init();
     init_cmd();
     console_init();
@@ -765,12 +1906,32 @@ int main(int argc, char *argv[])
     }
     if (logfile_name)
         set_logfile(logfile_name);
+    if (metrics_name && !set_metrics_file(metrics_name))
+        report(1, "Couldn't open metrics file '%s'", metrics_name);
+    if (buffer_output && !start_buffered_output())
+        report(1, "Could not start output thread.  Output is unbuffered");
+
+    if (compiled_name) {
+        /* The whole replay is one command in the metrics */
+        char *argv[] = {"replay", compiled_name};
+        metrics_mark_t mark;
+        metrics_begin(&mark);
+        bool ok = !infile_name || trace_compile(infile_name, compiled_name);
+        ok = ok && trace_replay(compiled_name);
+        metrics_end(&mark, 2, argv, ok);
+        metrics_close();
+        return ok ? 0 : 1;
+    }
 
     add_quit_helper(queue_quit);
 
     bool ok = true;
-    ok = ok && run_console(infile_name);
+    if (socket_name)
+        ok = ok && run_server(socket_name);
+    else
+        ok = ok && run_console(infile_name);
     ok = ok && finish_cmd();
+    metrics_close();
 
     return ok ? 0 : 1;
 }
@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,6 +6,330 @@
 #include "harness.h"
 #include "queue.h"
 
+/* Fewest slots of hash index */
+#define INDEX_MIN_SLOTS 16
+
+/*
+ * Whether two strings are equal.  First characters settle most unequal
+ * pairs without calling strcmp.
+ */
+static inline bool same_string(const char *s1, const char *s2)
+{
+    return s1[0] == s2[0] && strcmp(s1, s2) == 0;
+}
+
+/* Free element and its string */
+static void free_ele(list_ele_t *ele)
+{
+    free(ele->value);
+    free(ele);
+}
+
+/*
+ * Hash index sub-function
+ * FNV-1a hash of string s
+ */
+static unsigned int hash_string(const char *s)
+{
+    uint64_t h = 14695981039346656037ull;
+    while (*s)
+        h = (h ^ (uint8_t) *s++) * 1099511628211ull;
+    return (unsigned int) (h ^ (h >> 32));
+}
+
+/*
+ * Hash index sub-function
+ * Home slot of element by its address.  Addresses of blocks share their
+ * low bits, which the multiplication mixes into the others.
+ */
+static size_t node_home(queue_t *q, const list_ele_t *ele)
+{
+    uint64_t h = (uintptr_t) ele * 0x9e3779b97f4a7c15ull;
+    return (h ^ (h >> 32)) & (q->nslots - 1);
+}
+
+/*
+ * Hash index sub-function
+ * Slot of element, which must be in index.  Both tables are probed
+ * linearly from the home slot.
+ */
+static index_node_t *index_node(queue_t *q, const list_ele_t *ele)
+{
+    size_t i = node_home(q, ele);
+    while (q->nodes[i].ele != ele)
+        i = (i + 1) & (q->nslots - 1);
+    return &q->nodes[i];
+}
+
+/*
+ * Hash index sub-function
+ * Slot of string s of given hash, or the free slot where it would go
+ */
+static index_key_t *index_key(queue_t *q, const char *s, unsigned int hash)
+{
+    size_t i = hash & (q->nslots - 1);
+    for (index_key_t *key; (key = &q->keys[i])->first != NULL;
+         i = (i + 1) & (q->nslots - 1)) {
+        if (key->hash == hash && same_string(key->first->value, s))
+            break;
+    }
+    return &q->keys[i];
+}
+
+/*
+ * Hash index sub-function
+ * Add element, coming after prev in list, to index, which must have room
+ */
+static void index_put(queue_t *q, list_ele_t *ele, list_ele_t *prev)
+{
+    size_t i = node_home(q, ele);
+    while (q->nodes[i].ele != NULL)
+        i = (i + 1) & (q->nslots - 1);
+    index_node_t *node = &q->nodes[i];
+    node->ele = ele;
+    node->prev = prev;
+    node->same_prev = NULL;
+
+    unsigned int hash = hash_string(ele->value);
+    index_key_t *key = index_key(q, ele->value, hash);
+    if (key->first == NULL) {
+        node->same_next = NULL;
+        key->hash = hash;
+        key->count = 0;
+    } else {
+        node->same_next = key->first;
+        index_node(q, key->first)->same_prev = ele;
+    }
+    key->first = ele;
+    key->count++;
+}
+
+/*
+ * Hash index sub-function
+ * Free slot i of node table.  Later slots of its run of used slots are
+ * moved back into the freed one when they would no longer be found past it
+ */
+static void node_del(queue_t *q, size_t i)
+{
+    size_t mask = q->nslots - 1;
+    for (size_t j = (i + 1) & mask; q->nodes[j].ele != NULL;
+         j = (j + 1) & mask) {
+        size_t h = node_home(q, q->nodes[j].ele);
+        if (((j - h) & mask) >= ((j - i) & mask)) {
+            q->nodes[i] = q->nodes[j];
+            i = j;
+        }
+    }
+    q->nodes[i].ele = NULL;
+}
+
+/* Hash index sub-function, freeing slot i of key table like node_del */
+static void key_del(queue_t *q, size_t i)
+{
+    size_t mask = q->nslots - 1;
+    for (size_t j = (i + 1) & mask; q->keys[j].first != NULL;
+         j = (j + 1) & mask) {
+        size_t h = q->keys[j].hash & mask;
+        if (((j - h) & mask) >= ((j - i) & mask)) {
+            q->keys[i] = q->keys[j];
+            i = j;
+        }
+    }
+    q->keys[i].first = NULL;
+}
+
+/*
+ * Hash index sub-function
+ * Remove element from index, and from the elements holding its string
+ */
+static void index_del(queue_t *q, list_ele_t *ele)
+{
+    index_node_t *node = index_node(q, ele);
+    list_ele_t *same_prev = node->same_prev, *same_next = node->same_next;
+    if (same_next != NULL)
+        index_node(q, same_next)->same_prev = same_prev;
+    if (same_prev != NULL)
+        index_node(q, same_prev)->same_next = same_next;
+
+    index_key_t *key = index_key(q, ele->value, hash_string(ele->value));
+    if (same_prev == NULL)
+        key->first = same_next;
+    if (--key->count == 0)
+        key_del(q, key - q->keys);
+    node_del(q, node - q->nodes);
+}
+
+/*
+ * Hash index sub-function
+ * Empty both tables of index
+ */
+static void index_clear(queue_t *q)
+{
+    memset(q->nodes, 0, q->nslots * sizeof(index_node_t));
+    memset(q->keys, 0, q->nslots * sizeof(index_key_t));
+}
+
+/*
+ * Hash index sub-function
+ * Empty index, then add all elements of queue to it
+ */
+static void index_relink(queue_t *q)
+{
+    index_clear(q);
+    list_ele_t *prev = NULL;
+    for (list_ele_t *ele = q->head; ele != NULL; ele = ele->next) {
+        index_put(q, ele, prev);
+        prev = ele;
+    }
+}
+
+/*
+ * Hash index sub-function
+ * Replace index by one of nslots slots.
+ * Return false if could not allocate space, leaving index as it was.
+ */
+static bool index_build(queue_t *q, size_t nslots)
+{
+    index_node_t *nodes =
+        malloc(nslots * (sizeof(index_node_t) + sizeof(index_key_t)));
+    if (nodes == NULL)
+        return false;
+
+    free(q->nodes);
+    q->nodes = nodes;
+    q->keys = (index_key_t *) (nodes + nslots);
+    q->nslots = nslots;
+    index_relink(q);
+    return true;
+}
+
+/*
+ * Hash index sub-function
+ * Drop index of queue
+ */
+static void index_drop(queue_t *q)
+{
+    free(q->nodes);
+    q->nodes = NULL;
+    q->keys = NULL;
+    q->nslots = 0;
+}
+
+/*
+ * Hash index sub-function
+ * Number of slots for n elements.  Keeping the index at most half full
+ * keeps probes short.  There are never more strings than elements.
+ */
+static size_t index_slots_for(size_t n)
+{
+    size_t nslots = INDEX_MIN_SLOTS;
+    while (nslots < 2 * n)
+        nslots *= 2;
+    return nslots;
+}
+
+/*
+ * Hash index sub-function
+ * Make room for one more element in index of queue, if there is one.
+ * Return false if it could neither grow nor hold it, with a free slot left
+ * to end probes.
+ */
+static bool index_reserve(queue_t *q)
+{
+    if (q->nodes == NULL)
+        return true;
+    size_t nslots = index_slots_for(q->size + 1);
+    return nslots <= q->nslots || index_build(q, nslots) ||
+           (size_t) q->size + 1 < q->nslots;
+}
+
+/*
+ * Hash index sub-function
+ * Add element, just linked after prev, to index of queue if there is one
+ */
+static void index_add(queue_t *q, list_ele_t *ele, list_ele_t *prev)
+{
+    if (q->nodes == NULL)
+        return;
+    index_put(q, ele, prev);
+    if (ele->next != NULL)
+        index_node(q, ele->next)->prev = ele;
+}
+
+/*
+ * Hash index sub-function
+ * Remove element, still linked after prev, from index of queue if there is
+ * one
+ */
+static void index_remove(queue_t *q, list_ele_t *ele, list_ele_t *prev)
+{
+    if (q->nodes == NULL)
+        return;
+    index_del(q, ele);
+    if (ele->next != NULL)
+        index_node(q, ele->next)->prev = prev;
+}
+
+/*
+ * Hash index sub-function
+ * Relink index of queue, if there is one, after its elements moved around.
+ * Grow it first if queue has grown.  If it cannot, and the index cannot
+ * even hold all elements, drop it.
+ */
+static void index_refit(queue_t *q)
+{
+    if (q->nodes == NULL)
+        return;
+    size_t nslots = index_slots_for(q->size);
+    if (nslots > q->nslots && index_build(q, nslots))
+        return;
+    if ((size_t) q->size < q->nslots) {
+        index_relink(q);
+        return;
+    }
+    index_drop(q);
+}
+
+/*
+ * Hash index sub-function
+ * Empty index of src, whose elements went to dst, and add those from first
+ * to last, now linked after prev, to index of dst if there is one.  As
+ * dst has grown, check the size of its index first.
+ */
+static void index_move(queue_t *dst,
+                       queue_t *src,
+                       list_ele_t *prev,
+                       list_ele_t *first,
+                       list_ele_t *last)
+{
+    if (src->nodes != NULL)
+        index_clear(src);
+    if (dst->nodes == NULL)
+        return;
+    if (index_slots_for(dst->size) > dst->nslots) {
+        index_refit(dst);
+        return;
+    }
+
+    for (list_ele_t *ele = first; ele != last->next; ele = ele->next) {
+        index_put(dst, ele, prev);
+        prev = ele;
+    }
+    if (last->next != NULL)
+        index_node(dst, last->next)->prev = last;
+}
+
+/*
+ * Hash index sub-function
+ * Elements holding s.
+ * Return NULL if there is none.
+ */
+static index_key_t *index_find(queue_t *q, const char *s)
+{
+    index_key_t *key = index_key(q, s, hash_string(s));
+    return key->first != NULL ? key : NULL;
+}
+
 /*
  * Create empty queue.
  * Return NULL if could not allocate space.
@@ -18,6 +343,9 @@ queue_t *q_new()
         q->head = NULL;
         q->tail = NULL;
         q->size = 0; /* set size 0 initially */
+        q->nodes = NULL; /* Not indexed */
+        q->keys = NULL;
+        q->nslots = 0;
     }
 
     return q;
@@ -42,6 +370,7 @@ void q_free(queue_t *q)
         q->head = ptr;
     }
 
+    free(q->nodes); /* Free hash index, if any */
     free(q); /* Free queue structure space */
 }
 
@@ -81,6 +410,13 @@ bool q_insert_head(queue_t *q, char *s)
         return false;
     }
 
+    /* Hash index, if any, is grown before it would have to be undone */
+    if (!index_reserve(q)) {
+        free(newh->value);
+        free(newh);
+        return false;
+    }
+
     /* Copy the string */
     strncpy(newh->value, s, len_s);
     *(newh->value + len_s) = '\0';  // Set end-of-string
@@ -91,6 +427,7 @@ bool q_insert_head(queue_t *q, char *s)
     if (q->tail == NULL)
         q->tail = newh;  // Initialize case
     q->size++;
+    index_add(q, newh, NULL);
 
     return true;  // All allocation correct, return true
 }
@@ -131,11 +468,19 @@ bool q_insert_tail(queue_t *q, char *s)
         return false;
     }
 
+    /* Hash index, if any, is grown before it would have to be undone */
+    if (!index_reserve(q)) {
+        free(newt->value);
+        free(newt);
+        return false;
+    }
+
     /* Copy string */
     strncpy(newt->value, s, len_s);
     *(newt->value + len_s) = '\0';  // Edit end-of-string
 
     /* Do pointer and parameter edition (insert tail in queue)*/
+    list_ele_t *prev = q->tail;
     if (q->tail == NULL) {  // Initialize case
         q->head = newt;
     } else {
@@ -146,6 +491,7 @@ bool q_insert_tail(queue_t *q, char *s)
        (Because malloc() inital value may not be zero!) */
     newt->next = NULL;
     q->size++;
+    index_add(q, newt, prev);
 
     return true;  // All correct, return true
 }
@@ -178,6 +524,7 @@ bool q_remove_head(queue_t *q, char *sp, size_t bufsize)
     }
 
     /* Edit pointer and free node space */
+    index_remove(q, ptr, NULL);
     q->head = q->head->next;
     free(ptr->value);
     free(ptr);
@@ -236,9 +583,11 @@ void q_reverse(queue_t *q)
             nex = nex->next;
     }
 
-    /* Re-assign head and tail pointer */
+    /* Re-assign head and tail pointer.
+       Hash index knows the previous node of each, which all changed */
     q->tail = q->head;
     q->head = prev;
+    index_refit(q);
 }
 
 /*
@@ -331,4 +680,295 @@ void q_sort(queue_t *q)
         ptr = ptr->next;
     }
     q->tail = ptr;
+
+    /* Hash index knows the previous node of each, which changed */
+    index_refit(q);
+}
+
+/*
+ * Move all elements of src to the tail of dst, leaving src empty.
+ * No effect if either queue is NULL, or if they are the same queue.
+ */
+void q_concat(queue_t *dst, queue_t *src)
+{
+    if (dst == NULL || src == NULL || dst == src || src->head == NULL)
+        return;
+
+    /* Link list of src after tail of dst */
+    list_ele_t *prev = dst->tail;
+    if (dst->head == NULL)
+        dst->head = src->head;
+    else
+        dst->tail->next = src->head;
+    dst->tail = src->tail;
+    dst->size += src->size;
+    index_move(dst, src, prev, src->head, src->tail);
+
+    src->head = NULL;
+    src->tail = NULL;
+    src->size = 0;
+}
+
+/*
+ * Move all elements of src to the head of dst, leaving src empty.
+ * No effect if either queue is NULL, or if they are the same queue.
+ */
+void q_splice(queue_t *dst, queue_t *src)
+{
+    if (dst == NULL || src == NULL || dst == src || src->head == NULL)
+        return;
+
+    /* Link list of dst after tail of src */
+    src->tail->next = dst->head;
+    if (dst->head == NULL)
+        dst->tail = src->tail;
+    dst->head = src->head;
+    dst->size += src->size;
+    index_move(dst, src, NULL, src->head, src->tail);
+
+    src->head = NULL;
+    src->tail = NULL;
+    src->size = 0;
+}
+
+/*
+ * K-way merge sub-function
+ * Whether head of list a goes before head of list b
+ */
+static bool head_before(list_ele_t **heads, int a, int b)
+{
+    int cmp = strcmp(heads[a]->value, heads[b]->value);
+    return cmp < 0 || (cmp == 0 && a < b);
+}
+
+/*
+ * K-way merge sub-function
+ * Restore order of binary heap of n lists, from position i down
+ */
+static void sift_down(int *heap, int n, int i, list_ele_t **heads)
+{
+    for (;;) {
+        int min = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && head_before(heads, heap[l], heap[min]))
+            min = l;
+        if (r < n && head_before(heads, heap[r], heap[min]))
+            min = r;
+        if (min == i)
+            return;
+        int tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+/*
+ * Merge k sorted queues into qs[0], leaving the others empty.
+ * A binary heap holds the lists not exhausted yet, by their first element.
+ */
+void q_merge_sorted(queue_t **qs, int k)
+{
+    if (qs == NULL || k < 1 || qs[0] == NULL)
+        return;
+
+    /* Remaining part of each list, and its last element */
+    list_ele_t *heads[k], *tails[k];
+    int heap[k];
+    int n = 0, size = 0;
+    for (int i = 0; i < k; i++) {
+        if (qs[i] == NULL)
+            continue;
+        if (i > 0 && qs[i]->nodes != NULL)
+            index_clear(qs[i]);
+        if (qs[i]->head != NULL) {
+            heads[i] = qs[i]->head;
+            tails[i] = qs[i]->tail;
+            heap[n++] = i;
+        }
+        size += qs[i]->size;
+        qs[i]->head = NULL;
+        qs[i]->tail = NULL;
+        qs[i]->size = 0;
+    }
+    if (n == 0)
+        return;
+
+    for (int i = n / 2 - 1; i >= 0; i--)
+        sift_down(heap, n, i, heads);
+
+    list_ele_t *head = NULL, **link = &head;
+    while (n > 1) {
+        int top = heap[0];
+        list_ele_t *ele = heads[top];
+        *link = ele;
+        link = &ele->next;
+        heads[top] = ele->next;
+        if (heads[top] == NULL)
+            heap[0] = heap[--n];
+        sift_down(heap, n, 0, heads);
+    }
+
+    /* Last list left is linked as a whole */
+    *link = heads[heap[0]];
+    qs[0]->head = head;
+    qs[0]->tail = tails[heap[0]];
+    qs[0]->size = size;
+    index_refit(qs[0]);
+}
+
+/*
+ * Delete runs of equal strings from sorted queue, keeping the first element
+ * of each run if keep_one, else none of it.
+ */
+static bool delete_runs(queue_t *q, bool keep_one)
+{
+    if (q == NULL)
+        return false;
+
+    list_ele_t **link = &q->head, *last = NULL;
+    list_ele_t *ele = q->head;
+    while (ele != NULL) {
+        list_ele_t *next = ele->next;
+        bool dup = false;
+        while (next != NULL && same_string(ele->value, next->value)) {
+            list_ele_t *tmp = next->next;
+            free_ele(next);
+            q->size--;
+            next = tmp;
+            dup = true;
+        }
+
+        if (dup && !keep_one) {
+            free_ele(ele);
+            q->size--;
+        } else {
+            *link = ele;
+            link = &ele->next;
+            last = ele;
+        }
+        ele = next;
+    }
+    *link = NULL;
+    q->tail = last;
+    /* Deleted elements were left in index, which is quicker to rebuild */
+    index_refit(q);
+    return true;
+}
+
+/*
+ * Delete all elements whose string occurs more than once in sorted queue.
+ * Return true if successful, false if q is NULL.
+ */
+bool q_delete_dup(queue_t *q)
+{
+    return delete_runs(q, false);
+}
+
+/*
+ * Keep one element of each run of equal strings in sorted queue.
+ * Return true if successful, false if q is NULL.
+ */
+bool q_unique(queue_t *q)
+{
+    return delete_runs(q, true);
+}
+
+/*
+ * Build hash index of elements by their strings.
+ * Return true if successful, or already indexed.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_index(queue_t *q)
+{
+    if (q == NULL)
+        return false;
+    if (q->nodes != NULL)
+        return true;
+    return index_build(q, index_slots_for(q->size));
+}
+
+/* Drop hash index of queue */
+void q_unindex(queue_t *q)
+{
+    if (q == NULL || q->nodes == NULL)
+        return;
+
+    index_drop(q);
+}
+
+/* Return bytes used by hash index */
+size_t q_index_bytes(queue_t *q)
+{
+    if (q == NULL || q->nodes == NULL)
+        return 0;
+    return q->nslots * (sizeof(index_node_t) + sizeof(index_key_t));
+}
+
+/* Return whether some element of queue holds string s */
+bool q_contains(queue_t *q, char *s)
+{
+    if (q == NULL)
+        return false;
+    if (q->nodes != NULL)
+        return index_find(q, s) != NULL;
+
+    for (list_ele_t *ele = q->head; ele != NULL; ele = ele->next)
+        if (same_string(ele->value, s))
+            return true;
+    return false;
+}
+
+/* Return number of elements of queue holding string s */
+int q_count(queue_t *q, char *s)
+{
+    if (q == NULL)
+        return 0;
+
+    if (q->nodes != NULL) {
+        index_key_t *key = index_find(q, s);
+        return key != NULL ? key->count : 0;
+    }
+
+    int cnt = 0;
+    for (list_ele_t *ele = q->head; ele != NULL; ele = ele->next)
+        cnt += same_string(ele->value, s);
+    return cnt;
+}
+
+/*
+ * Attempt to remove an element holding string s.
+ * Return true if successful, false if q is NULL or no element holds s.
+ */
+bool q_remove_value(queue_t *q, char *s)
+{
+    if (q == NULL || q->head == NULL)
+        return false;
+
+    list_ele_t *prev = NULL, *ele = q->head;
+    if (q->nodes != NULL) {
+        /* Index knows the previous element, wherever the match is */
+        index_key_t *key = index_find(q, s);
+        if (key == NULL)
+            return false;
+        ele = key->first;
+        prev = index_node(q, ele)->prev;
+    } else {
+        while (ele != NULL && !same_string(ele->value, s)) {
+            prev = ele;
+            ele = ele->next;
+        }
+        if (ele == NULL)
+            return false;
+    }
+
+    index_remove(q, ele, prev);
+    if (prev == NULL)
+        q->head = ele->next;
+    else
+        prev->next = ele->next;
+    if (q->tail == ele)
+        q->tail = prev;
+    free_ele(ele);
+    q->size--;
+    return true;
 }
@@ -22,6 +22,23 @@ typedef struct ELE {
     struct ELE *next;
 } list_ele_t;
 
+/*
+ * Slot of hash index by element: the element, the one before it in the
+ * list, and its neighbours among the elements holding the same string
+ */
+typedef struct {
+    list_ele_t *ele; /* NULL if slot is free */
+    list_ele_t *prev;
+    list_ele_t *same_prev, *same_next;
+} index_node_t;
+
+/* Slot of hash index by string: the elements holding one string */
+typedef struct {
+    list_ele_t *first; /* NULL if slot is free */
+    unsigned int hash;
+    int count;
+} index_key_t;
+
 /* Queue structure */
 typedef struct {
     list_ele_t *head; /* Linked list of elements */
@@ -34,6 +51,13 @@ typedef struct {
 
     int size; /* Record the size of the queue */
 
+    /*
+     * Hash index, NULL when queue is not indexed.  Both tables have nslots
+     * slots, and share one block starting at nodes.
+     */
+    index_node_t *nodes;
+    index_key_t *keys;
+    size_t nslots;
 } queue_t;
 
 /* Operations on queue */
@@ -100,4 +124,93 @@ void q_reverse(queue_t *q);
  */
 void q_sort(queue_t *q);
 
+/*
+ * Move all elements of src to the tail of dst, leaving src empty.
+ * No effect if either queue is NULL, or if they are the same queue.
+ * This function should neither allocate nor free, and should run in
+ * constant time.
+ */
+void q_concat(queue_t *dst, queue_t *src);
+
+/*
+ * Move all elements of src to the head of dst, leaving src empty.
+ * No effect if either queue is NULL, or if they are the same queue.
+ * This function should neither allocate nor free, and should run in
+ * constant time.
+ */
+void q_splice(queue_t *dst, queue_t *src);
+
+/*
+ * Merge k sorted queues, all distinct, into qs[0], leaving the others empty.
+ * The result is in ascending order, elements comparing equal keeping the
+ * order of the queues they come from.
+ * No effect if qs[0] is NULL.  Other NULL queues are skipped.
+ * This function should neither allocate nor free list elements, and should
+ * run in O(n log k) time for n elements in total.
+ */
+void q_merge_sorted(queue_t **qs, int k);
+
+/*
+ * Delete all elements whose string occurs more than once in sorted queue,
+ * keeping only strings that were unique.
+ * Return true if successful, false if q is NULL.
+ * The space used by deleted elements and their strings should be freed.
+ * This function should not allocate, and should make a single pass.
+ */
+bool q_delete_dup(queue_t *q);
+
+/*
+ * Delete all but the first element of each run of equal strings in sorted
+ * queue, so that every string occurs once.
+ * Return true if successful, false if q is NULL.
+ * The space used by deleted elements and their strings should be freed.
+ * This function should not allocate, and should make a single pass.
+ */
+bool q_unique(queue_t *q);
+
+/*
+ * Build a hash index of elements by their strings, so that q_contains,
+ * q_count and q_remove_value need not walk the list.  Once built, the
+ * index is kept up to date by all operations on the queue.  Inserting
+ * then fails if the index cannot grow.  Moving elements into an indexed
+ * queue, by q_concat, q_splice or q_merge_sorted, takes time proportional
+ * to their number, or to the size of the queue for q_merge_sorted, and may
+ * grow the index.  If it cannot grow enough, the index is dropped.
+ * Return true if successful, or already indexed.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_index(queue_t *q);
+
+/*
+ * Drop hash index of queue.
+ * No effect if q is NULL or not indexed
+ */
+void q_unindex(queue_t *q);
+
+/*
+ * Return bytes used by hash index of queue.
+ * Return 0 if q is NULL or not indexed
+ */
+size_t q_index_bytes(queue_t *q);
+
+/*
+ * Return whether some element of queue holds string s.
+ * Return false if q is NULL or empty
+ */
+bool q_contains(queue_t *q, char *s);
+
+/*
+ * Return number of elements of queue holding string s.
+ * Return 0 if q is NULL or empty
+ */
+int q_count(queue_t *q, char *s);
+
+/*
+ * Attempt to remove an element holding string s, not necessarily the first.
+ * Return true if successful.
+ * Return false if q is NULL or no element holds s.
+ * The space used by the list element and the string should be freed.
+ */
+bool q_remove_value(queue_t *q, char *s);
+
 #endif /* LAB0_QUEUE_H */
@@ -1,25 +1,51 @@
 #include "random.h"
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/random.h>
 #include <unistd.h>
 
+/*
+ * Random bytes come from ChaCha20 run as a stream cipher on a zero
+ * plaintext, with a key drawn once per thread from the kernel.  This
+ * keeps system calls out of the loops preparing dudect inputs.
+ */
+
+static int fd = -1;
+static pthread_once_t fd_once = PTHREAD_ONCE_INIT;
+
+/* Generator state of each thread */
+static __thread uint32_t chacha_state[16];
+static __thread uint8_t keystream[64];
+static __thread size_t keystream_pos = sizeof(keystream);
+static __thread bool seeded = false;
+
+/* Bits left from last byte used by randombit */
+static __thread uint8_t bit_pool;
+static __thread int bit_count = 0;
+
+static void open_urandom(void)
+{
+    for (;;) {
+        fd = open("/dev/urandom", O_RDONLY);
+        if (fd != -1)
+            break;
+        sleep(1);
+    }
+}
+
 /* shameless stolen from ebacs */
-void randombytes(uint8_t *x, size_t how_much)
+static void urandom_bytes(uint8_t *x, size_t how_much)
 {
     ssize_t i;
-    static int fd = -1;
 
     ssize_t xlen = (ssize_t) how_much;
     assert(xlen >= 0);
-    if (fd == -1) {
-        for (;;) {
-            fd = open("/dev/urandom", O_RDONLY);
-            if (fd != -1)
-                break;
-            sleep(1);
-        }
-    }
+    pthread_once(&fd_once, open_urandom);
 
     while (xlen > 0) {
         if (xlen < 1048576)
@@ -38,9 +64,119 @@ void randombytes(uint8_t *x, size_t how_much)
     }
 }
 
+/* Fill x from the kernel, preferring getrandom over /dev/urandom */
+static void seed_bytes(uint8_t *x, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = getrandom(x, len, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            urandom_bytes(x, len);
+            return;
+        }
+        x += n;
+        len -= n;
+    }
+}
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+    do {                         \
+        a += b;                  \
+        d ^= a;                  \
+        d = ROTL32(d, 16);       \
+        c += d;                  \
+        b ^= c;                  \
+        b = ROTL32(b, 12);       \
+        a += b;                  \
+        d ^= a;                  \
+        d = ROTL32(d, 8);        \
+        c += d;                  \
+        b ^= c;                  \
+        b = ROTL32(b, 7);        \
+    } while (0)
+
+/* Produce next 64 bytes of keystream.  RFC 7539, section 2.3 */
+static void chacha_block(uint8_t out[64])
+{
+    uint32_t x[16];
+    memcpy(x, chacha_state, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        QUARTERROUND(x[0], x[4], x[8], x[12]);
+        QUARTERROUND(x[1], x[5], x[9], x[13]);
+        QUARTERROUND(x[2], x[6], x[10], x[14]);
+        QUARTERROUND(x[3], x[7], x[11], x[15]);
+        QUARTERROUND(x[0], x[5], x[10], x[15]);
+        QUARTERROUND(x[1], x[6], x[11], x[12]);
+        QUARTERROUND(x[2], x[7], x[8], x[13]);
+        QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++) {
+        uint32_t v = x[i] + chacha_state[i];
+        out[4 * i] = v;
+        out[4 * i + 1] = v >> 8;
+        out[4 * i + 2] = v >> 16;
+        out[4 * i + 3] = v >> 24;
+    }
+
+    /* 64-bit block counter, so that the stream never repeats */
+    if (++chacha_state[12] == 0)
+        chacha_state[13]++;
+}
+
+static void chacha_seed(void)
+{
+    /* "expand 32-byte k" */
+    chacha_state[0] = 0x61707865;
+    chacha_state[1] = 0x3320646e;
+    chacha_state[2] = 0x79622d32;
+    chacha_state[3] = 0x6b206574;
+    /* Key and nonce */
+    seed_bytes((uint8_t *) &chacha_state[4], 8 * sizeof(uint32_t));
+    seed_bytes((uint8_t *) &chacha_state[14], 2 * sizeof(uint32_t));
+    chacha_state[12] = chacha_state[13] = 0;
+    keystream_pos = sizeof(keystream);
+    seeded = true;
+}
+
+void randombytes(uint8_t *x, size_t how_much)
+{
+    if (!seeded)
+        chacha_seed();
+
+    while (how_much > 0) {
+        if (keystream_pos == sizeof(keystream)) {
+            /* Whole blocks go straight to the caller */
+            if (how_much >= sizeof(keystream)) {
+                chacha_block(x);
+                x += sizeof(keystream);
+                how_much -= sizeof(keystream);
+                continue;
+            }
+            chacha_block(keystream);
+            keystream_pos = 0;
+        }
+
+        size_t n = sizeof(keystream) - keystream_pos;
+        if (n > how_much)
+            n = how_much;
+        memcpy(x, keystream + keystream_pos, n);
+        keystream_pos += n;
+        x += n;
+        how_much -= n;
+    }
+}
+
 uint8_t randombit(void)
 {
-    uint8_t ret = 0;
-    randombytes(&ret, 1);
-    return (ret & 1);
+    if (bit_count == 0) {
+        randombytes(&bit_pool, 1);
+        bit_count = 8;
+    }
+    uint8_t ret = bit_pool & 1;
+    bit_pool >>= 1;
+    bit_count--;
+    return ret;
 }
@@ -0,0 +1,777 @@
+/* Compilation and replay of binary traces */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Our program needs to use regular malloc/free */
+#define INTERNAL 1
+#include "harness.h"
+
+#include "console.h"
+#include "gen.h"
+#include "queue.h"
+#include "replay.h"
+#include "report.h"
+#include "timing.h"
+
+#define TRACE_MAGIC 0x3043524c /* "LRC0" */
+#define TRACE_VERSION 2
+
+/* String ids with special meaning */
+#define STR_NONE UINT32_MAX
+#define STR_RAND (UINT32_MAX - 1)
+
+/* Size of buffer receiving removed strings, for the longest option length */
+#define REMOVE_BUFSIZE 1025
+
+typedef enum {
+    OP_NEW,
+    OP_FREE,
+    OP_IH,
+    OP_IT,
+    OP_RH,
+    OP_RHQ,
+    OP_REVERSE,
+    OP_SORT,
+    OP_SIZE,
+    OP_NR
+} opcode_t;
+
+static char *op_names[OP_NR] = {"new", "free", "ih",   "it",  "rh",
+                                "rhq", "reverse", "sort", "size"};
+
+/*
+ * File layout:
+ *   header
+ *   ops[nops]
+ *   stroff[nstrs], offset of each string relative to the string area
+ *   NUL-terminated strings
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nops;
+    uint32_t nstrs;
+    uint64_t str_bytes; /* Size of string area */
+} trace_hdr_t;
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t pad[3];
+    uint32_t str; /* Interned string id, or one of STR_* */
+    uint32_t count;
+} trace_op_t;
+
+/*
+ * Compilation
+ */
+
+/* Variable of the trace.  The name points into the line setting it */
+typedef struct {
+    char *name;
+    int value;
+} cvar_t;
+
+typedef struct {
+    trace_op_t *ops;
+    uint32_t nops;
+    uint64_t ops_cap;
+    char *strs; /* String area */
+    uint64_t str_bytes, strs_cap;
+    uint32_t *stroff;
+    uint32_t nstrs;
+    uint64_t stroff_cap;
+    /* Open addressing table of string ids, STR_NONE if empty */
+    uint32_t *slots;
+    uint32_t nslots;
+    cvar_t *vars; /* Variables set by var and repeat */
+    uint32_t nvars;
+    uint64_t vars_cap;
+    bool quit; /* Reached quit, ending the trace */
+    int length; /* Option length, to which rh cuts removed strings */
+} compiler_t;
+
+static bool grow(void **p, uint64_t *cap, uint64_t need, size_t elsize)
+{
+    if (need <= *cap)
+        return true;
+    uint64_t ncap = *cap ? *cap : 64;
+    while (ncap < need)
+        ncap *= 2;
+    void *np = realloc(*p, ncap * elsize);
+    if (!np)
+        return false;
+    *p = np;
+    *cap = ncap;
+    return true;
+}
+
+static uint32_t hash_string(char *s)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    while (*s)
+        h = (h ^ (uint8_t) *s++) * 16777619u;
+    return h;
+}
+
+static bool rehash(compiler_t *c, uint32_t nslots)
+{
+    uint32_t *slots = malloc(nslots * sizeof(uint32_t));
+    if (!slots)
+        return false;
+    memset(slots, 0xff, nslots * sizeof(uint32_t));
+    for (uint32_t id = 0; id < c->nstrs; id++) {
+        uint32_t i = hash_string(c->strs + c->stroff[id]) & (nslots - 1);
+        while (slots[i] != STR_NONE)
+            i = (i + 1) & (nslots - 1);
+        slots[i] = id;
+    }
+    free(c->slots);
+    c->slots = slots;
+    c->nslots = nslots;
+    return true;
+}
+
+/* Return id of string s, adding it to the string area when new */
+static bool intern(compiler_t *c, char *s, uint32_t *id)
+{
+    if (2 * (c->nstrs + 1) > c->nslots &&
+        !rehash(c, c->nslots ? 2 * c->nslots : 256))
+        return false;
+
+    uint32_t i = hash_string(s) & (c->nslots - 1);
+    while (c->slots[i] != STR_NONE) {
+        if (strcmp(c->strs + c->stroff[c->slots[i]], s) == 0) {
+            *id = c->slots[i];
+            return true;
+        }
+        i = (i + 1) & (c->nslots - 1);
+    }
+
+    size_t len = strlen(s) + 1;
+    if (!grow((void **) &c->strs, &c->strs_cap, c->str_bytes + len, 1) ||
+        !grow((void **) &c->stroff, &c->stroff_cap, c->nstrs + 1,
+              sizeof(uint32_t)))
+        return false;
+
+    memcpy(c->strs + c->str_bytes, s, len);
+    c->stroff[c->nstrs] = c->str_bytes;
+    c->str_bytes += len;
+    c->slots[i] = c->nstrs;
+    *id = c->nstrs++;
+    return true;
+}
+
+static bool emit(compiler_t *c, opcode_t opcode, uint32_t str, uint32_t count)
+{
+    if (c->nops == UINT32_MAX ||
+        !grow((void **) &c->ops, &c->ops_cap, c->nops + 1, sizeof(trace_op_t)))
+        return false;
+
+    trace_op_t *op = &c->ops[c->nops++];
+    memset(op, 0, sizeof(*op));
+    op->opcode = opcode;
+    op->str = str;
+    op->count = count;
+    return true;
+}
+
+/*
+ * Commands without effect on the queue, left out of compiled traces.
+ * Options are checked by compile_option first.
+ */
+static char *skipped_cmds[] = {"help", "option", "log", "show",
+                               "mem",  "var",    NULL};
+
+/* Tokens of a command line, expanded by repeat and var at compile time */
+#define MAX_ARGS 5
+
+typedef struct {
+    int lineno;
+    char *text; /* Copy of the line, holding the tokens */
+    int argc;
+    char *argv[MAX_ARGS];
+} line_t;
+
+static bool is_skipped(char *cmd)
+{
+    for (char **name = skipped_cmds; *name; name++)
+        if (strcmp(cmd, *name) == 0)
+            return true;
+    return false;
+}
+
+static cvar_t *find_cvar(compiler_t *c, char *name)
+{
+    for (uint32_t i = 0; i < c->nvars; i++)
+        if (strcmp(c->vars[i].name, name) == 0)
+            return &c->vars[i];
+    return NULL;
+}
+
+static bool set_cvar(compiler_t *c, char *name, int value)
+{
+    cvar_t *v = find_cvar(c, name);
+    if (!v) {
+        if (!grow((void **) &c->vars, &c->vars_cap, c->nvars + 1,
+                  sizeof(cvar_t)))
+            return false;
+        v = &c->vars[c->nvars++];
+        v->name = name;
+    }
+    v->value = value;
+    return true;
+}
+
+/* Integer argument, possibly a reference $name to a variable */
+static bool get_cint(compiler_t *c, char *arg, int *loc)
+{
+    if (arg[0] != '$')
+        return get_int(arg, loc);
+    cvar_t *v = find_cvar(c, arg + 1);
+    if (v)
+        *loc = v->value;
+    return v != NULL;
+}
+
+/* String argument, possibly a reference $name to a variable */
+static char *get_cstr(compiler_t *c, char *arg, char *buf, size_t size)
+{
+    cvar_t *v = arg[0] == '$' ? find_cvar(c, arg + 1) : NULL;
+    if (!v)
+        return arg;
+    snprintf(buf, size, "%d", v->value);
+    return buf;
+}
+
+/*
+ * Options that would change what replay runs.  Queue operations never fail
+ * on purpose in replay, nor are they checked in constant time.  Length is
+ * kept for rh.
+ */
+static bool compile_option(compiler_t *c, line_t *l)
+{
+    int value;
+    if (l->argc != 3)
+        return true;
+    char *name = l->argv[1];
+    bool changes = strcmp(name, "malloc") == 0 ||
+                   strcmp(name, "simulation") == 0;
+    bool length = strcmp(name, "length") == 0;
+    if (!changes && !length && strcmp(name, "fail") != 0)
+        return true;
+    if (!get_cint(c, l->argv[2], &value)) {
+        report(1, "Line %d: invalid value '%s'", l->lineno, l->argv[2]);
+        return false;
+    }
+    if (length) {
+        if (value < 0 || value >= REMOVE_BUFSIZE) {
+            report(1, "Line %d: replay cannot run with option length %d",
+                   l->lineno, value);
+            return false;
+        }
+        c->length = value;
+        return true;
+    }
+    if (value == 0)
+        return true;
+    if (changes) {
+        report(1, "Line %d: replay cannot run with option %s %d", l->lineno,
+               name, value);
+        return false;
+    }
+    report(1, "Line %d: Warning: replay does not check failed operations, "
+           "ignoring option fail",
+           l->lineno);
+    return true;
+}
+
+/* Evaluate "var name val [op operand]" as the console does */
+static bool compile_var(compiler_t *c, line_t *l)
+{
+    int value, operand;
+    if (l->argc != 3 && l->argc != 5) {
+        report(1, "Line %d: var needs 2 or 4 arguments", l->lineno);
+        return false;
+    }
+    if (!get_cint(c, l->argv[2], &value) ||
+        (l->argc == 5 && !get_cint(c, l->argv[4], &operand))) {
+        report(1, "Line %d: invalid value", l->lineno);
+        return false;
+    }
+    if (l->argc == 5) {
+        char op = strlen(l->argv[3]) == 1 ? l->argv[3][0] : 0;
+        if ((op == '/' || op == '%') && operand == 0) {
+            report(1, "Line %d: division by zero", l->lineno);
+            return false;
+        }
+        switch (op) {
+        case '+':
+            value += operand;
+            break;
+        case '-':
+            value -= operand;
+            break;
+        case '*':
+            value *= operand;
+            break;
+        case '/':
+            value /= operand;
+            break;
+        case '%':
+            value %= operand;
+            break;
+        default:
+            report(1, "Line %d: unknown operator '%s'", l->lineno,
+                   l->argv[3]);
+            return false;
+        }
+    }
+    if (!set_cvar(c, l->argv[1], value)) {
+        report(1, "Line %d: out of memory", l->lineno);
+        return false;
+    }
+    return true;
+}
+
+/* Translate one queue command.  Return false on error */
+static bool compile_cmd(compiler_t *c, line_t *l)
+{
+    int argc = l->argc;
+    char **argv = l->argv;
+    int opcode = 0;
+    while (opcode < OP_NR && strcmp(argv[0], op_names[opcode]) != 0)
+        opcode++;
+    if (opcode == OP_NR) {
+        if (is_skipped(argv[0]))
+            return true;
+        report(1, "Line %d: command '%s' cannot be compiled", l->lineno,
+               argv[0]);
+        return false;
+    }
+
+    uint32_t str = STR_NONE;
+    int count = 1;
+    char buf[REMOVE_BUFSIZE];
+    switch (opcode) {
+    case OP_NEW:
+        if (argc != 1) {
+            report(1, "Line %d: replay has a single queue, %s takes no name",
+                   l->lineno, argv[0]);
+            return false;
+        }
+        break;
+    case OP_IH:
+    case OP_IT:
+        if (argc != 2 && argc != 3) {
+            report(1, "Line %d: %s needs 1-2 arguments", l->lineno, argv[0]);
+            return false;
+        }
+        if (strcmp(argv[1], "RAND") == 0)
+            str = STR_RAND;
+        else if (!intern(c, get_cstr(c, argv[1], buf, sizeof(buf)), &str)) {
+            report(1, "Line %d: out of memory", l->lineno);
+            return false;
+        }
+        if (argc == 3 && (!get_cint(c, argv[2], &count) || count < 0)) {
+            report(1, "Line %d: invalid count '%s'", l->lineno, argv[2]);
+            return false;
+        }
+        break;
+    case OP_SIZE:
+        if (argc == 2 && (!get_cint(c, argv[1], &count) || count < 0)) {
+            report(1, "Line %d: invalid count '%s'", l->lineno, argv[1]);
+            return false;
+        }
+        break;
+    case OP_RH:
+        /*
+         * Count is the length removed strings are cut to, and the expected
+         * value, cut as well, is checked once the clock has stopped
+         */
+        count = c->length;
+        if (argc == 2) {
+            char cut[REMOVE_BUFSIZE];
+            char *expected = get_cstr(c, argv[1], buf, sizeof(buf));
+            snprintf(cut, c->length + 1, "%s", expected);
+            if (!intern(c, cut, &str)) {
+                report(1, "Line %d: out of memory", l->lineno);
+                return false;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (!emit(c, opcode, str, count)) {
+        report(1, "Line %d: out of memory or too many operations", l->lineno);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Translate lines [begin, end), unrolling repeat blocks with the variables
+ * they count in.  Return false on error
+ */
+static bool compile_lines(compiler_t *c, line_t *lines, int begin, int end)
+{
+    for (int i = begin; i < end && !c->quit; i++) {
+        line_t *l = &lines[i];
+        if (strcmp(l->argv[0], "quit") == 0) {
+            c->quit = true;
+            continue;
+        }
+        /* Bare var lists the variables, like show */
+        if (strcmp(l->argv[0], "var") == 0 && l->argc > 1) {
+            if (!compile_var(c, l))
+                return false;
+            continue;
+        }
+        if (strcmp(l->argv[0], "option") == 0 && !compile_option(c, l))
+            return false;
+        if (strcmp(l->argv[0], "end") == 0) {
+            report(1, "Line %d: end without matching repeat", l->lineno);
+            return false;
+        }
+        if (strcmp(l->argv[0], "repeat") != 0) {
+            if (!compile_cmd(c, l))
+                return false;
+            continue;
+        }
+
+        int reps, last = i + 1;
+        for (int depth = 1; last < end; last++) {
+            if (strcmp(lines[last].argv[0], "repeat") == 0)
+                depth++;
+            else if (strcmp(lines[last].argv[0], "end") == 0 && !--depth)
+                break;
+        }
+        if (last == end) {
+            report(1, "Line %d: unterminated repeat block", l->lineno);
+            return false;
+        }
+        if (l->argc != 2 && l->argc != 3) {
+            report(1, "Line %d: repeat needs 1-2 arguments", l->lineno);
+            return false;
+        }
+        if (!get_cint(c, l->argv[1], &reps) || reps < 0) {
+            report(1, "Line %d: invalid repeat count '%s'", l->lineno,
+                   l->argv[1]);
+            return false;
+        }
+        for (int r = 0; r < reps && !c->quit; r++) {
+            if (l->argc == 3 && !set_cvar(c, l->argv[2], r)) {
+                report(1, "Line %d: out of memory", l->lineno);
+                return false;
+            }
+            if (!compile_lines(c, lines, i + 1, last))
+                return false;
+        }
+        i = last;
+    }
+    return true;
+}
+
+/*
+ * Split line into l, leaving out a leading time, as timing is what replay is
+ * about.  Return false on error.  Blank lines and comments get no tokens
+ */
+static bool split_line(char *line, int lineno, line_t *l)
+{
+    char *save = NULL;
+    l->lineno = lineno;
+    l->argc = 0;
+    for (char *tok = strtok_r(line, " \t\r\n", &save); tok;
+         tok = strtok_r(NULL, " \t\r\n", &save)) {
+        if (l->argc == 0 && tok[0] == '#')
+            return true;
+        if (l->argc == 0 && strcmp(tok, "time") == 0)
+            continue;
+        if (l->argc == MAX_ARGS) {
+            report(1, "Line %d: too many arguments", lineno);
+            return false;
+        }
+        l->argv[l->argc++] = tok;
+    }
+    return true;
+}
+
+bool trace_compile(char *src, char *dst)
+{
+    FILE *in = fopen(src, "r");
+    if (!in) {
+        report(1, "Could not open trace file '%s'", src);
+        return false;
+    }
+
+    /* Lines are all read first, as repeat blocks are compiled many times */
+    compiler_t c;
+    memset(&c, 0, sizeof(c));
+    c.length = REMOVE_BUFSIZE - 1;
+    line_t *lines = NULL;
+    uint64_t lines_cap = 0;
+    int nlines = 0;
+    char *text = NULL;
+    size_t len = 0;
+    int lineno = 0;
+    bool ok = true;
+    while (ok && getline(&text, &len, in) != -1) {
+        ok = grow((void **) &lines, &lines_cap, nlines + 1, sizeof(line_t));
+        if (!ok) {
+            report(1, "Out of memory reading trace '%s'", src);
+            break;
+        }
+        line_t *l = &lines[nlines];
+        l->text = strdup(text);
+        if (!l->text) {
+            report(1, "Out of memory reading trace '%s'", src);
+            ok = false;
+            break;
+        }
+        ok = split_line(l->text, ++lineno, l);
+        if (ok && l->argc > 0)
+            nlines++;
+        else
+            free(l->text);
+    }
+    free(text);
+    fclose(in);
+
+    ok = ok && compile_lines(&c, lines, 0, nlines);
+
+    if (ok) {
+        trace_hdr_t hdr = {
+            .magic = TRACE_MAGIC,
+            .version = TRACE_VERSION,
+            .nops = c.nops,
+            .nstrs = c.nstrs,
+            .str_bytes = c.str_bytes,
+        };
+        FILE *out = fopen(dst, "w");
+        ok = out && fwrite(&hdr, sizeof(hdr), 1, out) == 1 &&
+             fwrite(c.ops, sizeof(trace_op_t), c.nops, out) == c.nops &&
+             fwrite(c.stroff, sizeof(uint32_t), c.nstrs, out) == c.nstrs &&
+             fwrite(c.strs, 1, c.str_bytes, out) == c.str_bytes;
+        if (out && fclose(out) != 0)
+            ok = false;
+        if (!ok)
+            report(1, "Could not write compiled trace '%s'", dst);
+        else
+            report(2, "Compiled %u operations and %u strings into '%s'",
+                   c.nops, c.nstrs, dst);
+    }
+
+    for (int i = 0; i < nlines; i++)
+        free(lines[i].text);
+    free(lines);
+    free(c.vars);
+    free(c.ops);
+    free(c.strs);
+    free(c.stroff);
+    free(c.slots);
+    return ok;
+}
+
+/*
+ * Replay
+ */
+
+/*
+ * Operations of opcodes with a count repeat on that many elements, and are
+ * also timed per element.  The others take a whole queue at once.
+ */
+typedef struct {
+    size_t calls;
+    size_t elements; /* Sum of counts */
+    double total_ns;
+    double max_ns;
+} op_stat_t;
+
+/* Check image and locate its sections.  Return true if well formed */
+static bool map_sections(uint8_t *image,
+                         size_t size,
+                         trace_op_t **ops,
+                         uint32_t **stroff,
+                         char **strs)
+{
+    trace_hdr_t *hdr = (trace_hdr_t *) image;
+    if (size < sizeof(*hdr) || hdr->magic != TRACE_MAGIC ||
+        hdr->version != TRACE_VERSION)
+        return false;
+
+    uint64_t need = sizeof(*hdr) + (uint64_t) hdr->nops * sizeof(trace_op_t) +
+                    (uint64_t) hdr->nstrs * sizeof(uint32_t) + hdr->str_bytes;
+    if (size != need)
+        return false;
+
+    *ops = (trace_op_t *) (image + sizeof(*hdr));
+    *stroff = (uint32_t *) (*ops + hdr->nops);
+    *strs = (char *) (*stroff + hdr->nstrs);
+    for (uint32_t i = 0; i < hdr->nops; i++) {
+        trace_op_t *op = &(*ops)[i];
+        if (op->opcode >= OP_NR ||
+            (op->str >= hdr->nstrs && op->str != STR_NONE &&
+             op->str != STR_RAND) ||
+            (op->opcode == OP_RH && op->count >= REMOVE_BUFSIZE))
+            return false;
+    }
+    for (uint32_t i = 0; i < hdr->nstrs; i++) {
+        if ((*stroff)[i] >= hdr->str_bytes)
+            return false;
+    }
+    return hdr->str_bytes == 0 || (*strs)[hdr->str_bytes - 1] == '\0';
+}
+
+bool trace_replay(char *file)
+{
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        report(1, "Could not open compiled trace '%s'", file);
+        return false;
+    }
+
+    struct stat st;
+    void *image = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        report(1, "Could not map compiled trace '%s'", file);
+        return false;
+    }
+
+    trace_op_t *ops;
+    uint32_t *stroff;
+    char *strs;
+    if (!map_sections(image, st.st_size, &ops, &stroff, &strs)) {
+        report(1, "'%s' is not a valid compiled trace", file);
+        munmap(image, st.st_size);
+        return false;
+    }
+    madvise(image, st.st_size, MADV_SEQUENTIAL);
+
+    uint32_t nops = ((trace_hdr_t *) image)->nops;
+    op_stat_t stats[OP_NR];
+    memset(stats, 0, sizeof(stats));
+    char removes[REMOVE_BUFSIZE];
+    char *rand_buf = NULL;
+    size_t rand_size = 0, slot = 0;
+    queue_t *q = NULL;
+    bool ok = true;
+
+    /* Replay measures the queue, not the checks of the harness */
+    set_cautious_mode(false);
+    for (uint32_t i = 0; ok && i < nops; i++) {
+        trace_op_t *op = &ops[i];
+        char *s = op->str < STR_RAND ? strs + stroff[op->str] : NULL;
+
+        /* Random strings are generated before the clock starts */
+        if (op->str == STR_RAND) {
+            slot = gen_slot();
+            if ((size_t) op->count * slot > rand_size) {
+                free(rand_buf);
+                rand_buf = malloc((size_t) op->count * slot);
+                rand_size = rand_buf ? (size_t) op->count * slot : 0;
+                if (!rand_buf) {
+                    report(1, "Could not allocate random strings");
+                    ok = false;
+                    break;
+                }
+            }
+            gen_strings(rand_buf, op->count);
+        }
+
+        bool removed = true;
+        double start = now_ns();
+        switch (op->opcode) {
+        case OP_NEW:
+            q_free(q);
+            q = q_new();
+            break;
+        case OP_FREE:
+            q_free(q);
+            q = NULL;
+            break;
+        case OP_IH:
+            for (uint32_t r = 0; r < op->count; r++)
+                q_insert_head(q, s ? s : rand_buf + r * slot);
+            break;
+        case OP_IT:
+            for (uint32_t r = 0; r < op->count; r++)
+                q_insert_tail(q, s ? s : rand_buf + r * slot);
+            break;
+        case OP_RH:
+            removed = q_remove_head(q, removes, op->count + 1);
+            break;
+        case OP_RHQ:
+            q_remove_head(q, NULL, 0);
+            break;
+        case OP_REVERSE:
+            q_reverse(q);
+            break;
+        case OP_SORT:
+            q_sort(q);
+            break;
+        case OP_SIZE:
+            for (uint32_t r = 0; r < op->count; r++)
+                q_size(q);
+            break;
+        }
+        double delta = now_ns() - start;
+
+        op_stat_t *stat = &stats[op->opcode];
+        stat->calls++;
+        stat->elements += op->count;
+        stat->total_ns += delta;
+        if (delta > stat->max_ns)
+            stat->max_ns = delta;
+        ok = !error_check();
+        if (op->opcode == OP_RH && s &&
+            (!removed || strcmp(removes, s) != 0)) {
+            report(1, "ERROR: Operation %u removed %s, expected %s", i + 1,
+                   removed ? removes : "nothing", s);
+            ok = false;
+        }
+    }
+
+    q_free(q);
+    set_cautious_mode(true);
+    free(rand_buf);
+    munmap(image, st.st_size);
+
+    report(1, "%-8s %10s %12s %12s %12s %12s %12s", "op", "calls",
+           "elements", "total ms", "ns/call", "ns/element", "max us");
+    for (int op = 0; op < OP_NR; op++) {
+        op_stat_t *stat = &stats[op];
+        if (!stat->calls)
+            continue;
+        char elements[32] = "-", per_element[32] = "-";
+        if (op == OP_IH || op == OP_IT || op == OP_SIZE) {
+            snprintf(elements, sizeof(elements), "%lu", stat->elements);
+            if (stat->elements)
+                snprintf(per_element, sizeof(per_element), "%.1f",
+                         stat->total_ns / stat->elements);
+        }
+        report(1, "%-8s %10lu %12s %12.3f %12.1f %12s %12.3f", op_names[op],
+               stat->calls, elements, stat->total_ns * 1.0E-6,
+               stat->total_ns / stat->calls, per_element,
+               stat->max_ns * 1.0E-3);
+    }
+
+    size_t bcnt = allocation_check();
+    if (bcnt > 0) {
+        report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
+               bcnt);
+        ok = false;
+    }
+    return ok;
+}
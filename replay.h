@@ -0,0 +1,30 @@
+#ifndef LAB0_REPLAY_H
+#define LAB0_REPLAY_H
+
+#include <stdbool.h>
+
+/*
+ * Compiled traces.
+ *
+ * A text trace is compiled into a flat array of fixed size operations, each
+ * made of an opcode, the id of an interned string and a repetition count.
+ * The compiled file is replayed straight from its memory mapped image,
+ * calling the queue functions directly, so it can be reused across runs
+ * without paying for line parsing and command dispatch.
+ */
+
+/*
+ * Compile text trace src into binary trace dst.  Return true if successful.
+ * Repeat blocks are unrolled and variables substituted as they are read.
+ * Commands that leave the queue alone, like option or show, are left out,
+ * but any other that replay cannot run fails the compilation, so that
+ * there is never a partial trace.
+ */
+bool trace_compile(char *src, char *dst);
+
+/* Replay binary trace and report latency per operation.
+ * Return true if successful.
+ */
+bool trace_replay(char *file);
+
+#endif /* LAB0_REPLAY_H */
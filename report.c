@@ -1,15 +1,17 @@
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/resource.h>
-#include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "report.h"
+#include "timing.h"
 
 #define MAX(a, b) ((a) < (b) ? (b) : (a))
 
@@ -24,6 +26,194 @@ static void init_files(FILE *efile, FILE *vfile)
     verbfile = vfile;
 }
 
+/*
+ * Buffered output.
+ * Regular messages are copied into a ring, and a background thread writes
+ * them to verbfile and logfile in batches.  Messages come from several
+ * threads, such as the server and dudect workers, which take ring_lock to
+ * put theirs; the background thread is the only one taking bytes out.
+ * Anything else, including every error and fatal path, first waits for the
+ * ring to drain and then writes synchronously, so ordering is preserved.
+ * Direct writes that are not about to exit also hold ring_lock, so that
+ * no message gets in before them.
+ * SIGALRM is blocked while ring_lock is held: the harness leaves a timed out
+ * operation with siglongjmp, which would otherwise leave the lock taken
+ * whenever the operation was reporting at the time.  The writer thread
+ * blocks it throughout, so that the alarm always goes to the main thread.
+ */
+#define RING_SIZE (1 << 20)
+static char ring[RING_SIZE];
+static atomic_size_t ring_head = 0; /* Bytes produced */
+static atomic_size_t ring_tail = 0; /* Bytes written out */
+static atomic_bool writer_stop = false;
+static bool buffered = false;
+static pthread_t writer;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* How long the writer sleeps when there is nothing to write */
+#define WRITER_IDLE_NS 1000000
+
+static void *writer_loop(void *arg)
+{
+    struct timespec idle = {0, WRITER_IDLE_NS};
+    for (;;) {
+        size_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+        if (head == tail) {
+            if (atomic_load(&writer_stop))
+                break;
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        while (tail != head) {
+            size_t start = tail % RING_SIZE;
+            size_t len = head - tail;
+            if (len > RING_SIZE - start)
+                len = RING_SIZE - start;
+            fwrite(ring + start, 1, len, verbfile);
+            if (logfile)
+                fwrite(ring + start, 1, len, logfile);
+            tail += len;
+        }
+        fflush(verbfile);
+        if (logfile)
+            fflush(logfile);
+        atomic_store_explicit(&ring_tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+/* Wait until background thread has written everything */
+static void drain_ring()
+{
+    while (atomic_load_explicit(&ring_tail, memory_order_acquire) !=
+           atomic_load_explicit(&ring_head, memory_order_relaxed))
+        sched_yield();
+}
+
+/* Hold off SIGALRM in calling thread, saving its signal mask in old */
+static void block_alarm(sigset_t *old)
+{
+    sigset_t alarm;
+    sigemptyset(&alarm);
+    sigaddset(&alarm, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alarm, old);
+}
+
+/* Take ring_lock, with SIGALRM held off until it is released */
+static void ring_lock_take(sigset_t *old)
+{
+    block_alarm(old);
+    pthread_mutex_lock(&ring_lock);
+}
+
+static void ring_lock_release(sigset_t *old)
+{
+    pthread_mutex_unlock(&ring_lock);
+    pthread_sigmask(SIG_SETMASK, old, NULL);
+}
+
+/* Called with ring_lock held */
+static void ring_put(char *buf, size_t len)
+{
+    size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    while (head + len -
+               atomic_load_explicit(&ring_tail, memory_order_acquire) >
+           RING_SIZE)
+        sched_yield();
+
+    size_t start = head % RING_SIZE;
+    size_t first = len < RING_SIZE - start ? len : RING_SIZE - start;
+    memcpy(ring + start, buf, first);
+    memcpy(ring, buf + first, len - first);
+    atomic_store_explicit(&ring_head, head + len, memory_order_release);
+}
+
+/*
+ * Queue formatted message.  Return false if it does not fit the staging
+ * buffer, in which case the caller writes it directly after draining.
+ */
+static bool buffer_message(char *fmt, va_list ap, bool newline)
+{
+    char buf[4 * MAX_CHAR];
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    if (len < 0 || len + 1 >= (int) sizeof(buf))
+        return false;
+    if (newline)
+        buf[len++] = '\n';
+    sigset_t old;
+    ring_lock_take(&old);
+    ring_put(buf, len);
+    ring_lock_release(&old);
+    return true;
+}
+
+/* Signal mask of the thread holding ring_lock for a direct write */
+static sigset_t direct_mask;
+
+/* Hold off other messages and drain ring, before writing directly */
+static void direct_begin()
+{
+    if (!buffered)
+        return;
+    sigset_t old;
+    ring_lock_take(&old);
+    direct_mask = old;
+    drain_ring();
+}
+
+static void direct_end()
+{
+    if (buffered) {
+        /* Copied first, as the next holder overwrites it */
+        sigset_t old = direct_mask;
+        ring_lock_release(&old);
+    }
+}
+
+static void stop_buffered_output()
+{
+    if (!buffered)
+        return;
+    drain_ring();
+    atomic_store(&writer_stop, true);
+    pthread_join(writer, NULL);
+    buffered = false;
+}
+
+bool start_buffered_output()
+{
+    if (buffered)
+        return true;
+    if (!verbfile)
+        init_files(stdout, stdout);
+
+    /*
+     * The writer inherits a mask blocking SIGALRM.  An alarm must not run
+     * its handler there while the main thread holds it off
+     */
+    sigset_t old;
+    block_alarm(&old);
+    atomic_store(&writer_stop, false);
+    bool started = pthread_create(&writer, NULL, writer_loop, NULL) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!started)
+        return false;
+    buffered = true;
+
+    static bool registered = false;
+    if (!registered)
+        registered = atexit(stop_buffered_output) == 0;
+    return true;
+}
+
+void report_flush()
+{
+    if (buffered)
+        drain_ring();
+}
+
 static char fail_buf[1024] = "FATAL Error.  Exiting\n";
 
 static volatile int ret = 0;
@@ -46,10 +236,24 @@ void set_verblevel(int level)
 
 bool set_logfile(char *file_name)
 {
+    direct_begin();
     logfile = fopen(file_name, "w");
+    direct_end();
     return logfile != NULL;
 }
 
+FILE *set_outfile(FILE *file)
+{
+    if (!verbfile)
+        init_files(stdout, stdout);
+
+    direct_begin();
+    FILE *old = verbfile;
+    init_files(file, file);
+    direct_end();
+    return old;
+}
+
 void report_event(message_t msg, char *fmt, ...)
 {
     va_list ap;
@@ -64,6 +268,7 @@ void report_event(message_t msg, char *fmt, ...)
     if (!errfile)
         init_files(stdout, stdout);
 
+    report_flush();
     va_start(ap, fmt);
     fprintf(errfile, "%s: ", msg_name);
     vfprintf(errfile, fmt, ap);
@@ -95,6 +300,15 @@ void report(int level, char *fmt, ...)
 
     if (level <= verblevel) {
         va_list ap;
+        if (buffered) {
+            va_start(ap, fmt);
+            bool done = buffer_message(fmt, ap, true);
+            va_end(ap);
+            if (done)
+                return;
+        }
+
+        direct_begin();
         va_start(ap, fmt);
         vfprintf(verbfile, fmt, ap);
         fprintf(verbfile, "\n");
@@ -108,6 +322,7 @@ void report(int level, char *fmt, ...)
             fflush(logfile);
             va_end(ap);
         }
+        direct_end();
     }
 }
 
@@ -118,6 +333,15 @@ void report_noreturn(int level, char *fmt, ...)
 
     if (level <= verblevel) {
         va_list ap;
+        if (buffered) {
+            va_start(ap, fmt);
+            bool done = buffer_message(fmt, ap, false);
+            va_end(ap);
+            if (done)
+                return;
+        }
+
+        direct_begin();
         va_start(ap, fmt);
         vfprintf(verbfile, fmt, ap);
         fflush(verbfile);
@@ -129,6 +353,7 @@ void report_noreturn(int level, char *fmt, ...)
             fflush(logfile);
             va_end(ap);
         }
+        direct_end();
     }
 }
 
@@ -137,6 +362,7 @@ void report_noreturn(int level, char *fmt, ...)
 /* Need to be able to print without using malloc */
 static void fail_fun(char *format, char *msg)
 {
+    report_flush();
     snprintf(fail_buf, sizeof(fail_buf), format, msg);
     /* Tack on return */
     fail_buf[strlen(fail_buf)] = '\n';
@@ -171,6 +397,11 @@ static size_t peak_bytes = 0;
 static size_t last_peak_bytes = 0;
 static size_t current_bytes = 0;
 
+/* Part of current_bytes held by blocks of the test harness */
+static size_t harness_blocks = 0;
+static size_t harness_payload = 0;
+static size_t harness_overhead = 0;
+
 static void check_exceed(size_t new_bytes)
 {
     size_t limit_bytes = (size_t) mblimit << 20;
@@ -272,6 +503,192 @@ void free_string(char *s)
     free_block((void *) s, strlen(s) + 1);
 }
 
+void note_allocation(size_t payload, size_t overhead)
+{
+    size_t bytes = payload + overhead;
+    check_exceed(bytes);
+
+    allocate_cnt++;
+    allocate_bytes += bytes;
+    current_bytes += bytes;
+    peak_bytes = MAX(peak_bytes, current_bytes);
+    last_peak_bytes = MAX(last_peak_bytes, current_bytes);
+
+    harness_blocks++;
+    harness_payload += payload;
+    harness_overhead += overhead;
+}
+
+void note_free(size_t payload, size_t overhead)
+{
+    size_t bytes = payload + overhead;
+    free_cnt++;
+    free_bytes += bytes;
+    current_bytes -= bytes;
+
+    harness_blocks--;
+    harness_payload -= payload;
+    harness_overhead -= overhead;
+}
+
+void mem_stat(mem_stat_t *st)
+{
+    st->current_bytes = current_bytes;
+    st->peak_bytes = peak_bytes;
+    st->allocate_cnt = allocate_cnt;
+    st->allocate_bytes = allocate_bytes;
+    st->free_cnt = free_cnt;
+    st->harness_blocks = harness_blocks;
+    st->harness_payload = harness_payload;
+    st->harness_overhead = harness_overhead;
+}
+
+/* Metrics */
+
+static FILE *metrics_file = NULL;
+static bool metrics_csv = false;
+/* CSV rows are all commands, so the summary gets a file of its own */
+static char *metrics_summary_name = NULL;
+
+/* State at start of current command */
+
+/* Summary */
+static size_t metrics_cmds = 0;
+static size_t metrics_failed = 0;
+static double metrics_total = 0;
+
+bool set_metrics_file(char *file_name)
+{
+    metrics_close();
+    metrics_file = fopen(file_name, "w");
+    if (!metrics_file)
+        return false;
+
+    size_t len = strlen(file_name);
+    metrics_csv = len >= 4 && strcmp(file_name + len - 4, ".csv") == 0;
+    if (metrics_csv) {
+        fprintf(metrics_file,
+                "cmd,args,ok,duration_ns,allocs,alloc_bytes,peak_bytes\n");
+        /* name.csv has its summary in name.summary.csv */
+        metrics_summary_name = malloc(len + sizeof(".summary"));
+        if (metrics_summary_name)
+            sprintf(metrics_summary_name, "%.*s.summary.csv", (int) len - 4,
+                    file_name);
+    }
+    return true;
+}
+
+/* Write s inside a quoted CSV field */
+static void metrics_csv_chars(char *s)
+{
+    for (; *s; s++) {
+        if (*s == '"')
+            fputc('"', metrics_file);
+        fputc(*s, metrics_file);
+    }
+}
+
+/* Write s as JSON string */
+static void metrics_json_string(char *s)
+{
+    fputc('"', metrics_file);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(metrics_file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(metrics_file, "\\u%04x", c);
+        else
+            fputc(c, metrics_file);
+    }
+    fputc('"', metrics_file);
+}
+
+void metrics_begin(metrics_mark_t *m)
+{
+    if (!metrics_file)
+        return;
+
+    m->allocate_cnt = allocate_cnt;
+    m->allocate_bytes = allocate_bytes;
+    m->outer_peak = last_peak_bytes;
+    last_peak_bytes = current_bytes;
+    m->start = now_ns();
+}
+
+void metrics_end(metrics_mark_t *m, int argc, char *argv[], bool ok)
+{
+    if (!metrics_file)
+        return;
+
+    double duration = now_ns() - m->start;
+    size_t allocs = allocate_cnt - m->allocate_cnt;
+    size_t bytes = allocate_bytes - m->allocate_bytes;
+    size_t peak = last_peak_bytes;
+    /* Peak of this command is also part of that of the enclosing one */
+    last_peak_bytes = MAX(m->outer_peak, peak);
+    metrics_cmds++;
+    metrics_failed += !ok;
+    metrics_total += duration;
+
+    if (metrics_csv) {
+        fputc('"', metrics_file);
+        metrics_csv_chars(argv[0]);
+        fputs("\",\"", metrics_file);
+        for (int i = 1; i < argc; i++) {
+            if (i > 1)
+                fputc(' ', metrics_file);
+            metrics_csv_chars(argv[i]);
+        }
+        fprintf(metrics_file, "\",%d,%.0f,%lu,%lu,%lu\n", ok, duration,
+                allocs, bytes, peak);
+    } else {
+        fputs("{\"cmd\":", metrics_file);
+        metrics_json_string(argv[0]);
+        fputs(",\"args\":[", metrics_file);
+        for (int i = 1; i < argc; i++) {
+            if (i > 1)
+                fputc(',', metrics_file);
+            metrics_json_string(argv[i]);
+        }
+        fprintf(metrics_file,
+                "],\"ok\":%s,\"duration_ns\":%.0f,\"allocs\":%lu,"
+                "\"alloc_bytes\":%lu,\"peak_bytes\":%lu}\n",
+                ok ? "true" : "false", duration, allocs, bytes, peak);
+    }
+}
+
+void metrics_close()
+{
+    if (!metrics_file)
+        return;
+
+    if (metrics_csv) {
+        FILE *summary =
+            metrics_summary_name ? fopen(metrics_summary_name, "w") : NULL;
+        if (summary) {
+            fprintf(summary,
+                    "commands,failed,duration_ns,allocs,alloc_bytes,"
+                    "peak_bytes,current_bytes\n");
+            fprintf(summary, "%lu,%lu,%.0f,%lu,%lu,%lu,%lu\n", metrics_cmds,
+                    metrics_failed, metrics_total, allocate_cnt,
+                    allocate_bytes, peak_bytes, current_bytes);
+            fclose(summary);
+        } else
+            report_event(MSG_WARN, "Couldn't write metrics summary");
+        free(metrics_summary_name);
+        metrics_summary_name = NULL;
+    } else
+        fprintf(metrics_file,
+                "{\"summary\":true,\"commands\":%lu,\"failed\":%lu,"
+                "\"duration_ns\":%.0f,\"allocs\":%lu,\"alloc_bytes\":%lu,"
+                "\"peak_bytes\":%lu,\"current_bytes\":%lu}\n",
+                metrics_cmds, metrics_failed, metrics_total, allocate_cnt,
+                allocate_bytes, peak_bytes, current_bytes);
+    fclose(metrics_file);
+    metrics_file = NULL;
+}
+
 /* Initialization of timers */
 void init_time(double *timep)
 {
@@ -280,9 +697,7 @@ void init_time(double *timep)
 
 double delta_time(double *timep)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    double current_time = tv.tv_sec + 1.0E-6 * tv.tv_usec;
+    double current_time = now_ns() * 1.0E-9;
     double delta = current_time - *timep;
     *timep = current_time;
     return delta;
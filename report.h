@@ -3,6 +3,7 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 /* Default reporting level.  Must recompile when change */
 #ifndef RPT
@@ -19,6 +20,18 @@ typedef enum { MSG_WARN, MSG_ERROR, MSG_FATAL } message_t;
 
 bool set_logfile(char *file_name);
 
+/* Send regular and error output to file.  Return previous output file */
+FILE *set_outfile(FILE *file);
+
+/*
+ * Buffer regular output and write it from a background thread.
+ * Errors are still reported synchronously.  Return true if successful.
+ */
+bool start_buffered_output();
+
+/* Wait until all buffered output has been written */
+void report_flush();
+
 extern int verblevel;
 void set_verblevel(int level);
 
@@ -49,6 +62,50 @@ void free_array(void *b, size_t cnt, size_t bytes);
 /* Free string saved by strsave_or_fail */
 void free_string(char *s);
 
+/*
+ * Account for block allocated elsewhere, as by the test harness.  Payload is
+ * what the caller asked for, overhead is what was added to check the block.
+ */
+void note_allocation(size_t payload, size_t overhead);
+void note_free(size_t payload, size_t overhead);
+
+/* Snapshot of memory accounting, in bytes unless noted */
+typedef struct {
+    size_t current_bytes; /* Live bytes, harness blocks included */
+    size_t peak_bytes;
+    size_t allocate_cnt; /* Number of allocations since start */
+    size_t allocate_bytes;
+    size_t free_cnt; /* Number of frees since start */
+    size_t harness_blocks; /* Live blocks of the test harness */
+    size_t harness_payload;
+    size_t harness_overhead;
+} mem_stat_t;
+
+void mem_stat(mem_stat_t *st);
+
+/** Metrics.  **/
+
+/*
+ * Record metrics of every command in file_name, as CSV when the name ends
+ * in ".csv" and as JSON Lines otherwise.  Return true if successful.
+ */
+bool set_metrics_file(char *file_name);
+
+/* Counters at start of a command, kept by the caller so commands can nest */
+typedef struct {
+    double start;
+    size_t allocate_cnt;
+    size_t allocate_bytes;
+    size_t outer_peak; /* Peak bytes of enclosing command up to now */
+} metrics_mark_t;
+
+/* Mark start and end of a command */
+void metrics_begin(metrics_mark_t *m);
+void metrics_end(metrics_mark_t *m, int argc, char *argv[], bool ok);
+
+/* Write summary and close metrics file */
+void metrics_close();
+
 /** Time measurement.  **/
 
 /* Time counted as fp number in seconds */
@@ -4,6 +4,8 @@ from __future__ import print_function
 import subprocess
 import sys
 import getopt
+import os
+import tempfile
 
 
 
@@ -35,7 +37,14 @@ class Tracer:
         14: "trace-14-perf",
         15: "trace-15-perf",
         16: "trace-16-perf",
-        17: "trace-17-complexity"
+        17: "trace-17-complexity",
+        18: "trace-18-index",
+        19: "trace-19-repeat",
+        20: "trace-20-replay",
+        21: "trace-21-sequential",
+        22: "trace-22-queues",
+        23: "trace-23-merge",
+        24: "trace-24-dedup"
     }
 
     traceProbs = {
@@ -55,10 +64,20 @@ class Tracer:
         14: "Trace-14",
         15: "Trace-15",
         16: "Trace-16",
-        17: "Trace-17"
+        17: "Trace-17",
+        18: "Trace-18",
+        19: "Trace-19",
+        20: "Trace-20",
+        21: "Trace-21",
+        22: "Trace-22",
+        23: "Trace-23",
+        24: "Trace-24"
     }
 
-    maxScores = [0, 6, 6, 6, 6, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5]
+    # Traces that are compiled with -c and then replayed
+    compiledTraces = {20}
+
+    maxScores = [0, 6, 6, 6, 6, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5, 6, 6, 6, 6, 6, 6, 6]
 
     RED = '\033[91m'
     GREEN = '\033[92m'
@@ -89,12 +108,20 @@ class Tracer:
         fname = "%s/%s.cmd" % (self.traceDirectory, self.traceDict[tid])
         vname = "%d" % self.verbLevel
         clist = self.command + ["-v", vname, "-f", fname]
-        
+        cname = None
+        if tid in self.compiledTraces:
+            fd, cname = tempfile.mkstemp(suffix=".bin")
+            os.close(fd)
+            clist += ["-c", cname]
+
         try:
             retcode = subprocess.call(clist)
         except Exception as e:
             self.printInColor("Call of '%s' failed: %s" % (" ".join(clist), e), self.RED)
             return False
+        finally:
+            if cname:
+                os.remove(cname)
         return retcode == 0
 
     def run(self, tid=0):
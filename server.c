@@ -0,0 +1,307 @@
+/* Event-driven Unix domain socket front end for the command interpreter */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "console.h"
+#include "report.h"
+#include "server.h"
+
+#define MAX_EVENTS 64
+
+/* Longest command line, as for console input */
+#define LINE_BUFSIZE 8192
+
+typedef struct SESSION session_t;
+struct SESSION {
+    int fd;
+    char in[LINE_BUFSIZE]; /* Received bytes not yet executed */
+    size_t inlen;
+    char *out; /* Responses not yet sent */
+    size_t outlen, outpos;
+    bool closing; /* Close once responses are sent */
+    cmd_context_t *ctx; /* Repeat blocks, variables and quit of session */
+    session_t *prev, *next;
+};
+
+static session_t *sessions = NULL;
+static int epfd = -1;
+static volatile sig_atomic_t stop_flag = 0;
+
+static void stop_handler(int sig)
+{
+    stop_flag = 1;
+}
+
+static void close_session(session_t *s)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        sessions = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+    free_context(s->ctx);
+    free(s->out);
+    free(s);
+}
+
+static void append_output(session_t *s, char *buf, size_t len)
+{
+    if (!len)
+        return;
+
+    char *out = realloc(s->out, s->outlen + len);
+    if (!out) {
+        report_event(MSG_ERROR, "Dropping %lu bytes of output", len);
+        return;
+    }
+    memcpy(out + s->outlen, buf, len);
+    s->out = out;
+    s->outlen += len;
+}
+
+/*
+ * Execute every complete line in the input buffer.
+ * Output of the whole batch is captured and queued in one piece.
+ */
+static void run_lines(session_t *s)
+{
+    char *capture = NULL;
+    size_t capture_len = 0;
+    FILE *cfile = open_memstream(&capture, &capture_len);
+    if (!cfile) {
+        report_event(MSG_ERROR, "Cannot capture output of session");
+        s->closing = true;
+        return;
+    }
+
+    FILE *old = set_outfile(cfile);
+    set_context(s->ctx);
+    char *line = s->in;
+    char *nl;
+    while (!s->closing &&
+           (nl = memchr(line, '\n', s->inlen - (line - s->in)))) {
+        *nl = '\0';
+        if (nl > line && nl[-1] == '\r')
+            nl[-1] = '\0';
+        bool ok = interpret_cmd(line);
+        /* quit closes the session, with no status */
+        if (context_quit(s->ctx))
+            s->closing = true;
+        else {
+            /* Messages of the command go out before its status */
+            report_flush();
+            fputs(ok ? "OK\n" : "ERROR\n", cfile);
+        }
+        line = nl + 1;
+    }
+    set_context(NULL);
+    set_outfile(old);
+    fclose(cfile);
+
+    s->inlen -= line - s->in;
+    memmove(s->in, line, s->inlen);
+    append_output(s, capture, capture_len);
+    free(capture);
+}
+
+/* Send pending responses.  Return false if session is gone */
+static bool flush_session(session_t *s)
+{
+    while (s->outpos < s->outlen) {
+        ssize_t n = send(s->fd, s->out + s->outpos, s->outlen - s->outpos,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            close_session(s);
+            return false;
+        }
+        s->outpos += n;
+    }
+
+    bool pending = s->outpos < s->outlen;
+    if (!pending) {
+        s->outpos = s->outlen = 0;
+        if (s->closing) {
+            close_session(s);
+            return false;
+        }
+    }
+
+    struct epoll_event ev = {
+        .events = EPOLLIN | (pending ? EPOLLOUT : 0),
+        .data.ptr = s,
+    };
+    epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev);
+    return true;
+}
+
+static void read_session(session_t *s)
+{
+    bool eof = false;
+    while (!eof) {
+        if (s->inlen == LINE_BUFSIZE - 1) {
+            /* Hit buffer limit.  Artificially terminate line */
+            s->in[s->inlen++] = '\n';
+            run_lines(s);
+        }
+
+        ssize_t n = read(s->fd, s->in + s->inlen, LINE_BUFSIZE - 1 - s->inlen);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0) {
+            /* Client is done.  Last line may lack its newline */
+            if (s->inlen > 0 && s->in[s->inlen - 1] != '\n')
+                s->in[s->inlen++] = '\n';
+            eof = true;
+        } else
+            s->inlen += n;
+    }
+
+    run_lines(s);
+    if (eof)
+        s->closing = true;
+    flush_session(s);
+}
+
+static void accept_sessions(int lfd)
+{
+    for (;;) {
+        int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                report_event(MSG_WARN, "accept failed: %s", strerror(errno));
+            return;
+        }
+
+        session_t *s = calloc(1, sizeof(session_t));
+        if (!s) {
+            report_event(MSG_WARN, "Cannot allocate session");
+            close(fd);
+            continue;
+        }
+        s->fd = fd;
+        s->ctx = new_context();
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = s};
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free_context(s->ctx);
+            free(s);
+            continue;
+        }
+        s->next = sessions;
+        if (sessions)
+            sessions->prev = s;
+        sessions = s;
+        report(3, "New session on fd %d", fd);
+    }
+}
+
+static int open_listener(char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        report(1, "Socket path '%s' is too long", path);
+        return -1;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lfd < 0) {
+        report(1, "Cannot create socket: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Replace stale socket left by an earlier run */
+    unlink(path);
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(lfd, SOMAXCONN) < 0) {
+        report(1, "Cannot listen on '%s': %s", path, strerror(errno));
+        close(lfd);
+        return -1;
+    }
+    return lfd;
+}
+
+bool run_server(char *path)
+{
+    int lfd = open_listener(path);
+    if (lfd < 0)
+        return false;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event lev = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &lev) < 0) {
+        report(1, "Cannot set up epoll: %s", strerror(errno));
+        if (epfd >= 0)
+            close(epfd);
+        close(lfd);
+        unlink(path);
+        return false;
+    }
+
+    /* Interrupt epoll_wait instead of restarting it */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* Errors made by one client must not stop the others */
+    set_err_limit(INT_MAX);
+    set_echo(false);
+    report(1, "Serving on '%s'", path);
+
+    bool ok = true;
+    struct epoll_event events[MAX_EVENTS];
+    while (!stop_flag) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            report(1, "epoll_wait failed: %s", strerror(errno));
+            ok = false;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            session_t *s = events[i].data.ptr;
+            if (!s) {
+                accept_sessions(lfd);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                read_session(s);
+            else if (events[i].events & EPOLLOUT)
+                flush_session(s);
+        }
+    }
+
+    while (sessions)
+        close_session(sessions);
+    close(epfd);
+    close(lfd);
+    unlink(path);
+    report(1, "Server stopped");
+    return ok;
+}
@@ -0,0 +1,20 @@
+#ifndef LAB0_SERVER_H
+#define LAB0_SERVER_H
+
+#include <stdbool.h>
+
+/*
+ * Serve queue commands to local clients over a Unix domain socket.
+ *
+ * Every connection is a session sending command lines, which may be
+ * pipelined.  Lines are executed in arrival order by the regular command
+ * interpreter, so all sessions share the queue and the options.  Each has
+ * its own repeat blocks and variables, though, and cannot source files.
+ * The output of each command is sent back, followed by a status line "OK"
+ * or "ERROR".  Running quit ends the session, not the server.
+ */
+
+/* Run server on socket path until interrupted.  Return true if successful */
+bool run_server(char *path);
+
+#endif /* LAB0_SERVER_H */
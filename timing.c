@@ -0,0 +1,69 @@
+/* Monotonic clock and calibrated tick counter */
+
+#include <time.h>
+
+#include "timing.h"
+
+/* Length of calibration of tick counter */
+#define CALIBRATION_NS 20000000
+
+/* Empty regions timed to find the overhead of timing */
+#define OVERHEAD_RUNS 1000
+
+/* Zero and UINT64_MAX until calibrated */
+static double ns_per_tick = 0;
+static uint64_t overhead_ticks = UINT64_MAX;
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Smallest count of an empty region, as larger ones were disturbed */
+static void calibrate_overhead()
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < OVERHEAD_RUNS; i++) {
+        uint64_t start = read_ticks_begin();
+        uint64_t end = read_ticks_end();
+        if (end - start < best)
+            best = end - start;
+    }
+    overhead_ticks = best;
+}
+
+void timing_init()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    uint64_t start_ns = now_ns();
+    uint64_t start_ticks = read_ticks();
+    uint64_t end_ns;
+    do {
+        end_ns = now_ns();
+    } while (end_ns - start_ns < CALIBRATION_NS);
+    uint64_t end_ticks = read_ticks();
+
+    if (end_ticks > start_ticks)
+        ns_per_tick = (double) (end_ns - start_ns) / (end_ticks - start_ticks);
+    else
+        ns_per_tick = 1.0;
+#else
+    ns_per_tick = 1.0;
+#endif
+}
+
+uint64_t ticks_overhead()
+{
+    if (overhead_ticks == UINT64_MAX)
+        calibrate_overhead();
+    return overhead_ticks;
+}
+
+double ticks_to_ns(uint64_t ticks)
+{
+    if (ns_per_tick == 0)
+        timing_init();
+    return ticks * ns_per_tick;
+}
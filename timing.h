@@ -0,0 +1,72 @@
+#ifndef LAB0_TIMING_H
+#define LAB0_TIMING_H
+
+#include <stdint.h>
+
+/*
+ * Monotonic timing for short measurements.
+ *
+ * now_ns reads CLOCK_MONOTONIC_RAW, which neither jumps nor is slewed by
+ * NTP.  read_ticks is cheaper: on x86 it reads the time stamp counter, which
+ * timing_init calibrates against the clock once at startup.  Elsewhere it
+ * falls back to now_ns, so that a tick is a nanosecond.
+ *
+ * read_ticks may be executed out of order with the code around it.  For
+ * short regions, bracket them with read_ticks_begin and read_ticks_end
+ * instead, which wait for earlier instructions to complete and keep later
+ * ones from starting, and subtract ticks_overhead, the cost of the pair
+ * itself.
+ */
+
+/* Calibrate tick rate.  Called once at startup, before any measurement */
+void timing_init();
+
+/* Nanoseconds since an arbitrary point in the past */
+uint64_t now_ns();
+
+/* Convert a number of ticks to nanoseconds */
+double ticks_to_ns(uint64_t ticks);
+
+/*
+ * Ticks between read_ticks_begin and read_ticks_end with nothing in between.
+ * Measured on first call, so that programs not timing short regions skip it.
+ */
+uint64_t ticks_overhead();
+
+static inline uint64_t read_ticks()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo;
+    __asm__ volatile("rdtsc\n\t" : "=a"(lo), "=d"(hi));
+    return ((uint64_t) lo) | (((uint64_t) hi) << 32);
+#else
+    return now_ns();
+#endif
+}
+
+static inline uint64_t read_ticks_begin()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo;
+    __asm__ volatile("lfence\n\trdtsc\n\t" : "=a"(lo), "=d"(hi)::"memory");
+    return ((uint64_t) lo) | (((uint64_t) hi) << 32);
+#else
+    return now_ns();
+#endif
+}
+
+static inline uint64_t read_ticks_end()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo;
+    __asm__ volatile("rdtscp\n\tlfence\n\t"
+                     : "=a"(lo), "=d"(hi)
+                     :
+                     : "ecx", "memory");
+    return ((uint64_t) lo) | (((uint64_t) hi) << 32);
+#else
+    return now_ns();
+#endif
+}
+
+#endif /* LAB0_TIMING_H */
@@ -0,0 +1,39 @@
+# Test hash index on queues holding many copies of few strings
+option fail 0
+option malloc 0
+new
+index
+ih dolphin 100000
+it bear 100000
+ih gerbil
+count dolphin
+count bear
+count meerkat
+contains gerbil
+rv gerbil
+contains gerbil
+rv dolphin
+count dolphin
+rh dolphin
+count dolphin
+reverse
+rh bear
+it dolphin 50000
+count dolphin
+count bear
+rv bear
+count bear
+index off
+count dolphin
+free
+# Index built after the copies are in
+new
+ih bear 50000
+it dolphin 50000
+index
+count bear
+count dolphin
+rv dolphin
+count dolphin
+rh bear
+free
@@ -0,0 +1,41 @@
+# Test of repeat blocks and variables
+option fail 0
+option malloc 0
+new
+repeat 3 i
+it $i
+end
+rh 0
+rh 1
+rh 2
+var n 4
+var m $n * 3
+var m $m - 1
+repeat $n
+ih dolphin
+end
+it $m
+rh dolphin
+rh dolphin
+rh dolphin
+rh dolphin
+rh 11
+# Nested blocks, with counters of their own
+repeat 2 i
+repeat 3 j
+var k $i * 10
+var k $k + $j
+it $k
+end
+end
+rh 0
+rh 1
+rh 2
+rh 10
+rh 11
+rh 12
+repeat 0
+it vulture
+end
+size
+free
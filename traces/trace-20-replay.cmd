@@ -0,0 +1,28 @@
+# Test of compiling a trace and replaying it
+option fail 0
+option malloc 0
+new
+var n 50
+repeat $n i
+it $i
+end
+repeat $n i
+rh $i
+end
+ih gerbil
+ih bear
+ih meerkat
+option length 4
+rh meer
+rh bear
+option length 1024
+rh gerbil
+var s 2 * 3
+ih $s
+it aardvark
+reverse
+rh aardvark
+rh 6
+var
+size
+free
@@ -0,0 +1,14 @@
+# Check that tries stopped early agree with whole tries on constant time ops
+option simulation 1
+ih
+it
+rh
+size
+# Each verdict is compared with the one of the whole tries above
+option sequential 1
+ih
+it
+rh
+size
+option sequential 0
+option simulation 0
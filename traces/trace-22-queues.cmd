@@ -0,0 +1,45 @@
+# Test of named queues, concat and splice
+option fail 0
+option malloc 0
+new a
+it gerbil
+it bear
+new b
+it dragon
+it lion
+show a
+use a
+concat b
+show
+show b
+new c
+ih zebra
+ih yak
+use a
+splice c
+size
+rh yak
+rh zebra
+rh gerbil
+rh bear
+rh dragon
+rh lion
+# Moving from an empty queue leaves the current one as it is
+it vulture
+concat b
+splice c
+rh vulture
+# Each queue keeps its elements across switches
+use b
+it cat
+use c
+it dog
+use b
+rh cat
+use c
+rh dog
+free
+use b
+free
+use a
+free
@@ -0,0 +1,60 @@
+# Test of merging sorted queues
+option fail 0
+option malloc 0
+new a
+it bear
+it gerbil
+it vulture
+new b
+it aardvark
+it dolphin
+it zebra
+new c
+it cat
+it gerbil
+new d
+use a
+merge b c d
+size
+rh aardvark
+rh bear
+rh cat
+rh dolphin
+rh gerbil
+rh gerbil
+rh vulture
+rh zebra
+# Merged queues are left empty, and can be refilled
+use b
+size
+it yak
+use c
+it lion
+use a
+merge b c
+rh lion
+rh yak
+# Merging into an empty queue
+new e
+merge a
+size
+# Many elements, with RAND strings sorted first
+use a
+it RAND 500
+sort
+use b
+it RAND 500
+sort
+use e
+merge a b
+size
+use a
+free
+use b
+free
+use c
+free
+use d
+free
+use e
+free
@@ -0,0 +1,62 @@
+# Test of dedup and unique on sorted queues
+option fail 0
+option malloc 0
+new
+it bear
+it bear
+it cat
+it dolphin
+it dolphin
+it dolphin
+it gerbil
+dedup
+size
+rh cat
+rh gerbil
+size
+it bear
+it bear
+it cat
+it dolphin
+it dolphin
+it dolphin
+it gerbil
+unique
+rh bear
+rh cat
+rh dolphin
+rh gerbil
+size
+# Queues that are all duplicates, or have none
+it yak 5
+dedup
+size
+it yak 5
+unique
+rh yak
+size
+it aardvark
+it bear
+it cat
+dedup
+rh aardvark
+rh bear
+rh cat
+it aardvark
+it bear
+unique
+rh aardvark
+rh bear
+# Empty queue
+dedup
+unique
+size
+# Many elements, with few distinct strings
+it RAND 1000
+gen uniform 1 1
+it RAND 1000
+sort
+unique
+sort
+dedup
+free